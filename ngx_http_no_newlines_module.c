@@ -8,27 +8,103 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
-#define SC_OFF  "<!--SC_OFF-->"
-#define SC_ON   "<!--SC_ON-->"
-#define SC_OFF_LEN  (sizeof(SC_OFF)-1)
-#define SC_ON_LEN   (sizeof(SC_ON)-1)
+#include "no_newlines.h"
+
+/* Output buffers must hold a held-back marker and a byte of progress */
+#define NGX_HTTP_NO_NEWLINES_MIN_BUF   64
+
+/* What ngx_http_types_slot sets the keys to for "*" */
+#define NGX_HTTP_NO_NEWLINES_ANY_TYPES  ((void *) -1)
 
 /* Declarations */
 
+/*
+ * What a stripped body is looked up by: the identity of the file it came
+ * from, and how it was stripped
+ */
+typedef struct {
+        ngx_file_uniq_t uniq;
+        time_t          mtime;
+        off_t           size;
+        ngx_uint_t      mode;    /* the engine */
+        uint32_t        options; /* a hash of the options of the HTML engine */
+} ngx_http_no_newlines_key_t;
+
+typedef struct {
+        ngx_rbtree_node_t                node;   /* key is a hash of "key" */
+        ngx_queue_t                      queue;  /* most recently used first */
+        ngx_http_no_newlines_key_t key;
+        ngx_uint_t                       count;  /* requests sending the body */
+        size_t                           len;
+        u_char                           data[1];
+} ngx_http_no_newlines_cache_node_t;
+
 typedef struct {
-        unsigned char state;
+        ngx_rbtree_t      rbtree;
+        ngx_rbtree_node_t sentinel;
+        ngx_queue_t       queue;
+} ngx_http_no_newlines_cache_sh_t;
+
+typedef struct {
+        ngx_http_no_newlines_cache_sh_t *sh;
+        ngx_slab_pool_t                 *shpool;
+        size_t                           max_size; /* of a body to be cached */
+} ngx_http_no_newlines_cache_t;
+
+typedef struct {
+        no_newlines_t nl;                 /* the state of the engine */
+
+        ngx_chain_t  *in;                 /* input not processed yet */
+        ngx_buf_t    *buf;                /* the output buffer being filled */
+        ngx_chain_t  *out;
+        ngx_chain_t **last_out;
+        ngx_chain_t  *busy;
+        ngx_chain_t  *free;
+        ngx_int_t     bufs;               /* output buffers allocated */
+
+        ngx_http_no_newlines_cache_t      *cache;
+        ngx_http_no_newlines_cache_node_t *cached; /* the body being sent */
+        ngx_http_no_newlines_cache_node_t *fill;   /* the body being cached */
+        size_t                             fill_size;
+
+        unsigned         minified:1; /* a pre-minified file is sent as is */
+
+        ngx_buf_t       *stored;     /* the stored body being sent */
+        unsigned         reading:1;  /* it is read in, a buffer at a time */
+        ngx_temp_file_t *temp;       /* the body being stored */
+        ngx_str_t        store_name; /* where it goes once complete */
 } ngx_http_no_newlines_ctx_t;
 
 typedef struct {
-        ngx_flag_t enable; /* A flag to enable or disable module functionality. */
+        ngx_flag_t      enable; /* A flag to enable or disable module functionality. */
+        ngx_bufs_t      bufs;   /* Number and size of the output buffers. */
+        ngx_shm_zone_t *cache;  /* The zone stripped static files are kept in. */
+        ngx_path_t     *store;  /* The directory they are written to. */
+        ngx_flag_t      minified; /* Whether to send foo.min.html for foo.html. */
+        ngx_hash_t      types;  /* The MIME types stripped, to their engines. */
+        ngx_array_t    *types_keys;
+        ngx_array_t    *preserve; /* Elements whose content is sent as it is. */
+        ngx_array_t    *markers;  /* Pairs of markers sent as SC_OFF and SC_ON are. */
+        ngx_flag_t      drop_markers; /* Whether markers are left out of the response. */
+        ngx_array_t    *comments; /* The starts of comments kept when others are not. */
+        ngx_flag_t      blocks;   /* Whether space by block-level tags is dropped. */
+        ngx_int_t       level;    /* How much more than whitespace HTML loses. */
+        no_newlines_conf_t *engine; /* The options built from the above, if any. */
+        uint32_t        options;  /* A hash of them, for the cache and store. */
 } ngx_http_no_newlines_conf_t;
 
-typedef enum {
-        state_text_compress = 0,
-        state_text_no_compress
-} ngx_http_no_newlines_state_e;
+/* Which engine strips a MIME type; types not listed are stripped as HTML */
+typedef struct {
+        ngx_str_t          type;
+        no_newlines_mode_e mode;
+} ngx_http_no_newlines_type_t;
 
+typedef struct {
+        ngx_uint_t kernel; /* The scan kernel requested by no_newlines_kernel. */
+} ngx_http_no_newlines_main_conf_t;
 
+static void *ngx_http_no_newlines_create_main_conf (ngx_conf_t *cf);
+static char *ngx_http_no_newlines_init_main_conf (ngx_conf_t *cf, void *conf);
 static void *ngx_http_no_newlines_create_conf (ngx_conf_t *cf);
 static char *ngx_http_no_newlines_merge_conf (ngx_conf_t *cf,
                                               void *parent,
@@ -37,9 +113,120 @@ static ngx_int_t ngx_http_no_newlines_header_filter (ngx_http_request_t *r);
 static ngx_int_t ngx_http_no_newlines_body_filter (ngx_http_request_t *r,
                                                    ngx_chain_t *in);
 static ngx_int_t ngx_http_no_newlines_filter_init (ngx_conf_t *cf);
-static void ngx_http_no_newlines_strip_buffer (ngx_buf_t *buffer,
+static ngx_int_t ngx_http_no_newlines_static_handler (ngx_http_request_t *r);
+static ngx_int_t ngx_http_no_newlines_static_type (ngx_http_request_t *r,
+                                                   ngx_hash_t *types);
+static ngx_int_t ngx_http_no_newlines_init_process (ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_no_newlines_copy (ngx_http_request_t *r,
+                                            ngx_http_no_newlines_ctx_t *ctx,
+                                            ngx_buf_t *b);
+static ngx_int_t ngx_http_no_newlines_get_buf (ngx_http_request_t *r,
                                                ngx_http_no_newlines_ctx_t *ctx);
-static ngx_int_t ngx_is_space (u_char* c);
+static ngx_int_t ngx_http_no_newlines_link (ngx_http_request_t *r,
+                                            ngx_http_no_newlines_ctx_t *ctx,
+                                            ngx_buf_t *b);
+static ngx_int_t ngx_http_no_newlines_link_flags (ngx_http_request_t *r,
+                                                  ngx_http_no_newlines_ctx_t *ctx,
+                                                  ngx_buf_t *b);
+static char *ngx_http_no_newlines_cache (ngx_conf_t *cf, ngx_command_t *cmd,
+                                         void *conf);
+static ngx_int_t ngx_http_no_newlines_cache_init_zone (ngx_shm_zone_t *shm_zone,
+                                                       void *data);
+static ngx_int_t ngx_http_no_newlines_file_key (ngx_http_request_t *r,
+                                                ngx_http_no_newlines_key_t *key,
+                                                ngx_str_t *path);
+static ngx_int_t ngx_http_no_newlines_replace (ngx_http_request_t *r,
+                                               ngx_http_no_newlines_ctx_t *ctx,
+                                               ngx_chain_t *in);
+static ngx_int_t ngx_http_no_newlines_cache_lookup (ngx_http_request_t *r,
+                                                    ngx_http_no_newlines_ctx_t *ctx,
+                                                    ngx_shm_zone_t *zone,
+                                                    ngx_http_no_newlines_key_t *key);
+static void ngx_http_no_newlines_cache_append (ngx_http_no_newlines_ctx_t *ctx,
+                                               ngx_buf_t *b);
+static void ngx_http_no_newlines_cache_commit (ngx_http_no_newlines_ctx_t *ctx);
+static void ngx_http_no_newlines_cache_cleanup (void *data);
+static ngx_http_no_newlines_cache_node_t *ngx_http_no_newlines_cache_find (
+        ngx_http_no_newlines_cache_t *cache, ngx_http_no_newlines_key_t *key,
+        uint32_t hash);
+static void *ngx_http_no_newlines_cache_alloc (ngx_http_no_newlines_cache_t *cache,
+                                               size_t size);
+static char *ngx_http_no_newlines_store (ngx_conf_t *cf, ngx_command_t *cmd,
+                                         void *conf);
+static ngx_int_t ngx_http_no_newlines_store_lookup (ngx_http_request_t *r,
+                                                    ngx_http_no_newlines_ctx_t *ctx,
+                                                    ngx_path_t *store,
+                                                    ngx_http_no_newlines_key_t *key,
+                                                    ngx_str_t *path);
+static ngx_uint_t ngx_http_no_newlines_store_in_memory (ngx_http_request_t *r,
+                                                        ngx_buf_t *file);
+static ngx_int_t ngx_http_no_newlines_store_send (ngx_http_request_t *r,
+                                                   ngx_http_no_newlines_ctx_t *ctx);
+static ngx_int_t ngx_http_no_newlines_store_read (ngx_http_request_t *r, ngx_buf_t *file,
+                                                  ngx_buf_t *b);
+static void ngx_http_no_newlines_store_append (ngx_http_no_newlines_ctx_t *ctx,
+                                               ngx_buf_t *b);
+static void ngx_http_no_newlines_store_commit (ngx_http_request_t *r,
+                                               ngx_http_no_newlines_ctx_t *ctx);
+static void ngx_http_no_newlines_cache_insert_value (ngx_rbtree_node_t *temp,
+                                                     ngx_rbtree_node_t *node,
+                                                     ngx_rbtree_node_t *sentinel);
+static char *ngx_http_no_newlines_preserve (ngx_conf_t *cf, ngx_command_t *cmd,
+                                            void *conf);
+static char *ngx_http_no_newlines_markers (ngx_conf_t *cf, ngx_command_t *cmd,
+                                           void *conf);
+static char *ngx_http_no_newlines_strip_comments (ngx_conf_t *cf, ngx_command_t *cmd,
+                                                  void *conf);
+static ngx_int_t ngx_http_no_newlines_merge_engine (ngx_conf_t *cf,
+                                                   ngx_http_no_newlines_conf_t *prev,
+                                                   ngx_http_no_newlines_conf_t *conf);
+static void ngx_http_no_newlines_set_modes (ngx_array_t *types_keys);
+static no_newlines_mode_e *ngx_http_no_newlines_type_mode (u_char *type, size_t len);
+/* Values of the no_newlines_kernel directive */
+static ngx_conf_enum_t  ngx_http_no_newlines_kernels[] = {
+        { ngx_string ("auto"),     no_newlines_kernel_auto },
+        { ngx_string ("scalar"),   no_newlines_kernel_scalar },
+        { ngx_string ("sse2"),     no_newlines_kernel_sse2 },
+        { ngx_string ("avx2"),     no_newlines_kernel_avx2 },
+        { ngx_string ("avx512bw"), no_newlines_kernel_avx512bw },
+        { ngx_null_string, 0 }
+};
+
+
+/* Values of the no_newlines_level directive */
+static ngx_conf_num_bounds_t  ngx_http_no_newlines_level_bounds = {
+        ngx_conf_check_num_bounds, 1, 3
+};
+
+
+/* Engines for the types that are not stripped as HTML */
+static ngx_http_no_newlines_type_t  ngx_http_no_newlines_types[] = {
+        { ngx_string ("text/xml"),               no_newlines_mode_xml },
+        { ngx_string ("application/xml"),        no_newlines_mode_xml },
+        { ngx_string ("image/svg+xml"),          no_newlines_mode_xml },
+        { ngx_string ("application/json"),       no_newlines_mode_json },
+        { ngx_string ("text/css"),               no_newlines_mode_css },
+        { ngx_string ("application/javascript"), no_newlines_mode_js },
+        { ngx_string ("text/javascript"),        no_newlines_mode_js },
+        { ngx_string ("application/x-javascript"), no_newlines_mode_js },
+        { ngx_null_string, 0 }
+};
+
+/* Engines for structured syntax suffixes, as in application/ld+json */
+static ngx_http_no_newlines_type_t  ngx_http_no_newlines_suffixes[] = {
+        { ngx_string ("+xml"),                   no_newlines_mode_xml },
+        { ngx_string ("+json"),                  no_newlines_mode_json },
+        { ngx_null_string, 0 }
+};
+
+/* What the types hash points to, indexed by no_newlines_mode_e */
+static no_newlines_mode_e  ngx_http_no_newlines_modes[] = {
+        no_newlines_mode_html,
+        no_newlines_mode_xml,
+        no_newlines_mode_json,
+        no_newlines_mode_css,
+        no_newlines_mode_js
+};
 
 
 /* Module directives */
@@ -51,6 +238,90 @@ static ngx_command_t  ngx_http_no_newlines_commands[] = {
           offsetof(ngx_http_no_newlines_conf_t, enable),
           NULL },
 
+        { ngx_string ("no_newlines_types"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
+          ngx_http_types_slot,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          offsetof(ngx_http_no_newlines_conf_t, types_keys),
+          &ngx_http_html_default_types[0] },
+
+        { ngx_string ("no_newlines_preserve"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
+          ngx_http_no_newlines_preserve,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          0,
+          NULL },
+
+        { ngx_string ("no_newlines_markers"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
+          ngx_http_no_newlines_markers,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          0,
+          NULL },
+
+        { ngx_string ("no_newlines_drop_markers"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_FLAG,
+          ngx_conf_set_flag_slot,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          offsetof(ngx_http_no_newlines_conf_t, drop_markers),
+          NULL },
+
+        { ngx_string ("no_newlines_strip_comments"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
+          ngx_http_no_newlines_strip_comments,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          0,
+          NULL },
+
+        { ngx_string ("no_newlines_blocks"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_FLAG,
+          ngx_conf_set_flag_slot,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          offsetof(ngx_http_no_newlines_conf_t, blocks),
+          NULL },
+
+        { ngx_string ("no_newlines_level"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+          ngx_conf_set_num_slot,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          offsetof(ngx_http_no_newlines_conf_t, level),
+          &ngx_http_no_newlines_level_bounds },
+
+        { ngx_string ("no_newlines_kernel"),
+          NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE1,
+          ngx_conf_set_enum_slot,
+          NGX_HTTP_MAIN_CONF_OFFSET,
+          offsetof(ngx_http_no_newlines_main_conf_t, kernel),
+          &ngx_http_no_newlines_kernels },
+
+        { ngx_string ("no_newlines_buffers"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE2,
+          ngx_conf_set_bufs_slot,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          offsetof(ngx_http_no_newlines_conf_t, bufs),
+          NULL },
+
+        { ngx_string ("no_newlines_cache"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+          ngx_http_no_newlines_cache,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          0,
+          NULL },
+
+        { ngx_string ("no_newlines_store"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE12,
+          ngx_http_no_newlines_store,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          0,
+          NULL },
+
+        { ngx_string ("no_newlines_static"),
+          NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_FLAG,
+          ngx_conf_set_flag_slot,
+          NGX_HTTP_LOC_CONF_OFFSET,
+          offsetof(ngx_http_no_newlines_conf_t, minified),
+          NULL },
+
         ngx_null_command
 };
 
@@ -60,8 +331,8 @@ static ngx_http_module_t  ngx_http_no_newlines_module_ctx = {
         NULL,                             /* pre-configuration */
         ngx_http_no_newlines_filter_init, /* post-configuration */
 
-        NULL,                             /* create main configuration */
-        NULL,                             /* init main configuration */
+        ngx_http_no_newlines_create_main_conf, /* create main configuration */
+        ngx_http_no_newlines_init_main_conf,   /* init main configuration */
 
         NULL,                             /* create server configuration */
         NULL,                             /* merge server configuration */
@@ -79,7 +350,7 @@ ngx_module_t ngx_http_no_newlines_module = {
         NGX_HTTP_MODULE,                  /* module type */
         NULL,                             /* init master */
         NULL,                             /* init module */
-        NULL,                             /* init process */
+        ngx_http_no_newlines_init_process, /* init process */
         NULL,                             /* init thread */
         NULL,                             /* exit thread */
         NULL,                             /* exit process */
@@ -95,6 +366,41 @@ static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 /* Function definitions start here */
 
 
+static void *ngx_http_no_newlines_create_main_conf (ngx_conf_t *cf)
+{
+        ngx_http_no_newlines_main_conf_t *nmcf;
+
+        nmcf = ngx_pcalloc (cf->pool, sizeof(ngx_http_no_newlines_main_conf_t));
+        if (nmcf == NULL) {
+                return NULL;
+        }
+
+        nmcf->kernel = NGX_CONF_UNSET_UINT;
+
+        return nmcf;
+}
+
+
+static char *ngx_http_no_newlines_init_main_conf (ngx_conf_t *cf, void *conf)
+{
+        ngx_http_no_newlines_main_conf_t *nmcf = conf;
+
+        if (nmcf->kernel == NGX_CONF_UNSET_UINT) {
+                nmcf->kernel = no_newlines_kernel_auto;
+        }
+
+        if (no_newlines_kernel_name (nmcf->kernel) == NULL) {
+                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                    "no_newlines_kernel \"%V\" is not available "
+                                    "on this platform",
+                                    &ngx_http_no_newlines_kernels[nmcf->kernel].name);
+                return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+}
+
+
 static void *ngx_http_no_newlines_create_conf (ngx_conf_t *cf)
 {
         ngx_http_no_newlines_conf_t *conf;
@@ -105,6 +411,15 @@ static void *ngx_http_no_newlines_create_conf (ngx_conf_t *cf)
         }
 
         conf->enable = NGX_CONF_UNSET;
+        conf->minified = NGX_CONF_UNSET;
+        conf->cache = NGX_CONF_UNSET_PTR;
+        conf->store = NGX_CONF_UNSET_PTR;
+        conf->preserve = NGX_CONF_UNSET_PTR;
+        conf->markers = NGX_CONF_UNSET_PTR;
+        conf->drop_markers = NGX_CONF_UNSET;
+        conf->comments = NGX_CONF_UNSET_PTR;
+        conf->blocks = NGX_CONF_UNSET;
+        conf->level = NGX_CONF_UNSET;
 
         return conf;
 }
@@ -118,166 +433,1924 @@ static char *ngx_http_no_newlines_merge_conf (ngx_conf_t *cf,
         ngx_http_no_newlines_conf_t *conf = child;
 
         ngx_conf_merge_value(conf->enable, prev->enable, 0);
+        ngx_conf_merge_bufs_value(conf->bufs, prev->bufs,
+                                  (128 * 1024) / ngx_pagesize, ngx_pagesize);
+        ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
+        ngx_conf_merge_ptr_value(conf->store, prev->store, NULL);
+        ngx_conf_merge_value(conf->minified, prev->minified, 0);
+        ngx_conf_merge_ptr_value(conf->preserve, prev->preserve, NULL);
+        ngx_conf_merge_ptr_value(conf->markers, prev->markers, NULL);
+        ngx_conf_merge_value(conf->drop_markers, prev->drop_markers, 1);
+        ngx_conf_merge_ptr_value(conf->comments, prev->comments, NULL);
+        ngx_conf_merge_value(conf->blocks, prev->blocks, 0);
+        ngx_conf_merge_value(conf->level, prev->level, 1);
+
+        /* the defaults are set here rather than by ngx_http_merge_types, */
+        /* so that their engines are set before the hash is built */
+        if (conf->types_keys == NULL && prev->types_keys == NULL &&
+            prev->types.buckets == NULL &&
+            ngx_http_set_default_types (cf, &prev->types_keys,
+                                        ngx_http_html_default_types) != NGX_OK) {
+                return NGX_CONF_ERROR;
+        }
+
+        ngx_http_no_newlines_set_modes (conf->types_keys);
+        ngx_http_no_newlines_set_modes (prev->types_keys);
+
+        if (ngx_http_merge_types (cf, &conf->types_keys, &conf->types,
+                                  &prev->types_keys, &prev->types,
+                                  ngx_http_html_default_types) != NGX_CONF_OK) {
+                return NGX_CONF_ERROR;
+        }
+
+        if (conf->bufs.size < NGX_HTTP_NO_NEWLINES_MIN_BUF) {
+                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                    "no_newlines_buffers size must be at least %d",
+                                    NGX_HTTP_NO_NEWLINES_MIN_BUF);
+                return NGX_CONF_ERROR;
+        }
+
+        if (ngx_http_no_newlines_merge_engine (cf, prev, conf) != NGX_OK) {
+                return NGX_CONF_ERROR;
+        }
 
         return NGX_CONF_OK;
 }
 
 
-static ngx_int_t ngx_http_no_newlines_filter_init (ngx_conf_t *cf)
+/*
+ * Builds the options of the HTML engine, or leaves none when HTML is
+ * stripped as it always was.  Options inherited as a whole share the
+ * enclosing level's copy, which is built by the first level to need it.
+ */
+static ngx_int_t ngx_http_no_newlines_merge_engine (ngx_conf_t *cf,
+                                                   ngx_http_no_newlines_conf_t *prev,
+                                                   ngx_http_no_newlines_conf_t *conf)
 {
-        ngx_http_next_header_filter = ngx_http_top_header_filter;
-        ngx_http_top_header_filter = ngx_http_no_newlines_header_filter;
+        ngx_uint_t          i, inherited;
+        ngx_str_t          *name;
+        no_newlines_conf_t *engine;
 
-        ngx_http_next_body_filter = ngx_http_top_body_filter;
-        ngx_http_top_body_filter = ngx_http_no_newlines_body_filter;
+        inherited = (conf->preserve == prev->preserve && conf->markers == prev->markers
+                     && conf->drop_markers == prev->drop_markers
+                     && conf->comments == prev->comments && conf->blocks == prev->blocks
+                     && conf->level == prev->level);
+
+        if (inherited && prev->engine) {
+                conf->engine = prev->engine;
+                conf->options = prev->options;
+                return NGX_OK;
+        }
+
+        if (conf->preserve == NULL && conf->markers == NULL && conf->drop_markers
+            && conf->comments == NULL && !conf->blocks && conf->level == 1) {
+                return NGX_OK;
+        }
+
+        engine = ngx_palloc (cf->pool, sizeof(no_newlines_conf_t));
+        if (engine == NULL) {
+                return NGX_ERROR;
+        }
+
+        no_newlines_conf_init (engine);
+
+        if (conf->preserve) {
+                name = conf->preserve->elts;
+
+                for (i = 0; i < conf->preserve->nelts; i++) {
+                        if (no_newlines_conf_element (engine, name[i].data, name[i].len) != 0) {
+                                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                                    "cannot preserve \"%V\"", &name[i]);
+                                return NGX_ERROR;
+                        }
+                }
+        }
+
+        if (conf->markers) {
+                name = conf->markers->elts;
+
+                for (i = 0; i < conf->markers->nelts; i += 2) {
+                        if (no_newlines_conf_markers (engine, name[i].data, name[i].len,
+                                                      name[i + 1].data, name[i + 1].len) != 0) {
+                                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                                    "cannot use markers \"%V\" and \"%V\"",
+                                                    &name[i], &name[i + 1]);
+                                return NGX_ERROR;
+                        }
+                }
+        }
+
+        if (!conf->drop_markers) {
+                no_newlines_conf_keep_markers (engine);
+        }
+
+        if (conf->comments) {
+                no_newlines_conf_comments (engine);
+
+                name = conf->comments->elts;
+
+                for (i = 0; i < conf->comments->nelts; i++) {
+                        if (no_newlines_conf_comment (engine, name[i].data, name[i].len) != 0) {
+                                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                                    "cannot keep comments starting with \"%V\"",
+                                                    &name[i]);
+                                return NGX_ERROR;
+                        }
+                }
+        }
+
+        if (conf->blocks) {
+                no_newlines_conf_blocks (engine);
+        }
+
+        no_newlines_conf_level (engine, (unsigned int) conf->level);
+
+        conf->engine = engine;
+        conf->options = ngx_crc32_short ((u_char *) engine, sizeof(no_newlines_conf_t));
+
+        if (inherited) {
+                prev->engine = conf->engine;
+                prev->options = conf->options;
+        }
 
         return NGX_OK;
 }
 
 
-static ngx_int_t ngx_http_no_newlines_header_filter (ngx_http_request_t *r)
+/* no_newlines_preserve element ... | off */
+static char *ngx_http_no_newlines_preserve (ngx_conf_t *cf, ngx_command_t *cmd,
+                                            void *conf)
 {
-        ngx_http_no_newlines_ctx_t   *ctx;  /* to maintain state */
-        ngx_http_no_newlines_conf_t  *conf; /* to check whether module is enabled or not */
+        ngx_http_no_newlines_conf_t *nlcf = conf;
 
-        conf = ngx_http_get_module_loc_conf (r, ngx_http_no_newlines_module);
+        ngx_str_t  *value, *name;
+        ngx_uint_t  i;
 
-        /* step 1: decide whether to operate */
-        if ((r->headers_out.status != NGX_HTTP_OK &&
-             r->headers_out.status != NGX_HTTP_FORBIDDEN &&
-             r->headers_out.status != NGX_HTTP_NOT_FOUND) ||
-            r->header_only ||
-            r->headers_out.content_type.len == 0 ||
-            (r->headers_out.content_encoding &&
-             r->headers_out.content_encoding->value.len) ||
-            conf->enable == 0) {
-                return ngx_http_next_header_filter(r);
+        if (nlcf->preserve != NGX_CONF_UNSET_PTR) {
+                return "is duplicate";
         }
 
-        if (ngx_strncasecmp(r->headers_out.content_type.data, (u_char *)"text/html", sizeof("text/html") - 1) != 0) {
-                return ngx_http_next_header_filter(r);
+        value = cf->args->elts;
+
+        if (cf->args->nelts == 2 && ngx_strcmp (value[1].data, "off") == 0) {
+                nlcf->preserve = NULL;
+                return NGX_CONF_OK;
         }
 
-        /* step 2: operate on the header */
-        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_no_newlines_ctx_t));
-        if (ctx == NULL) {
-                return NGX_ERROR;
+        if (cf->args->nelts - 1 > NO_NEWLINES_ELEMENTS_MAX) {
+                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                    "no more than %d elements can be preserved",
+                                    NO_NEWLINES_ELEMENTS_MAX);
+                return NGX_CONF_ERROR;
         }
 
-        ngx_http_set_ctx(r, ctx, ngx_http_no_newlines_module);
+        nlcf->preserve = ngx_array_create (cf->pool, cf->args->nelts - 1, sizeof(ngx_str_t));
+        if (nlcf->preserve == NULL) {
+                return NGX_CONF_ERROR;
+        }
 
-        ngx_http_clear_content_length(r);
-        ngx_http_clear_accept_ranges(r);
-        r->main_filter_need_in_memory = 1;
+        for (i = 1; i < cf->args->nelts; i++) {
+                if (value[i].len == 0 || value[i].len > NO_NEWLINES_NAME_MAX) {
+                        ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                            "invalid element name \"%V\"", &value[i]);
+                        return NGX_CONF_ERROR;
+                }
 
-        /* step 3: call the next filter */
-        return ngx_http_next_header_filter(r);
+                name = ngx_array_push (nlcf->preserve);
+                if (name == NULL) {
+                        return NGX_CONF_ERROR;
+                }
+
+                *name = value[i];
+        }
+
+        return NGX_CONF_OK;
 }
 
 
-static ngx_int_t ngx_http_no_newlines_body_filter (ngx_http_request_t *r,
-                                                   ngx_chain_t *in)
+/* no_newlines_markers off on ... */
+static char *ngx_http_no_newlines_markers (ngx_conf_t *cf, ngx_command_t *cmd,
+                                           void *conf)
 {
-        ngx_http_no_newlines_ctx_t *ctx;
-        ngx_chain_t *chain_link;
+        ngx_http_no_newlines_conf_t *nlcf = conf;
 
-        /* Get the current context */
-        ctx = ngx_http_get_module_ctx (r, ngx_http_no_newlines_module);
+        ngx_str_t  *value, *marker;
+        ngx_uint_t  i;
 
-        if (ctx == NULL) {
-                return ngx_http_next_body_filter(r, in);
+        if (nlcf->markers != NGX_CONF_UNSET_PTR) {
+                return "is duplicate";
+        }
+
+        value = cf->args->elts;
+
+        if ((cf->args->nelts - 1) % 2) {
+                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                    "markers must be given in pairs of an off and an on one");
+                return NGX_CONF_ERROR;
+        }
+
+        if ((cf->args->nelts - 1) / 2 > NO_NEWLINES_MARKERS_MAX) {
+                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                    "no more than %d pairs of markers can be given",
+                                    NO_NEWLINES_MARKERS_MAX);
+                return NGX_CONF_ERROR;
+        }
+
+        nlcf->markers = ngx_array_create (cf->pool, cf->args->nelts - 1, sizeof(ngx_str_t));
+        if (nlcf->markers == NULL) {
+                return NGX_CONF_ERROR;
+        }
+
+        for (i = 1; i < cf->args->nelts; i++) {
+                if (value[i].len > NO_NEWLINES_PATTERN_MAX) {
+                        ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                            "invalid marker \"%V\"", &value[i]);
+                        return NGX_CONF_ERROR;
+                }
+
+                marker = ngx_array_push (nlcf->markers);
+                if (marker == NULL) {
+                        return NGX_CONF_ERROR;
+                }
+
+                *marker = value[i];
+        }
+
+        return NGX_CONF_OK;
+}
+
+
+/* no_newlines_strip_comments on [prefix ...] | off */
+static char *ngx_http_no_newlines_strip_comments (ngx_conf_t *cf, ngx_command_t *cmd,
+                                                  void *conf)
+{
+        ngx_http_no_newlines_conf_t *nlcf = conf;
+
+        ngx_str_t  *value, *prefix;
+        ngx_uint_t  i;
+
+        if (nlcf->comments != NGX_CONF_UNSET_PTR) {
+                return "is duplicate";
+        }
+
+        value = cf->args->elts;
+
+        if (cf->args->nelts == 2 && ngx_strcmp (value[1].data, "off") == 0) {
+                nlcf->comments = NULL;
+                return NGX_CONF_OK;
+        }
+
+        if (ngx_strcmp (value[1].data, "on") != 0) {
+                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                    "invalid value \"%V\", it must be \"on\" or \"off\"",
+                                    &value[1]);
+                return NGX_CONF_ERROR;
+        }
+
+        /* an empty list, rather than NULL, when no comment is kept */
+        nlcf->comments = ngx_array_create (cf->pool, cf->args->nelts - 1, sizeof(ngx_str_t));
+        if (nlcf->comments == NULL) {
+                return NGX_CONF_ERROR;
         }
 
-        /* For each buffer in the chain link, remove all the newlines */
-        for (chain_link = in; chain_link; chain_link = chain_link->next) {
-                ngx_http_no_newlines_strip_buffer (chain_link->buf, ctx);
+        for (i = 2; i < cf->args->nelts; i++) {
+                if (value[i].len == 0
+                    || value[i].len > NO_NEWLINES_PATTERN_MAX - sizeof("<!--") + 1) {
+                        ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                            "invalid comment prefix \"%V\"", &value[i]);
+                        return NGX_CONF_ERROR;
+                }
+
+                prefix = ngx_array_push (nlcf->comments);
+                if (prefix == NULL) {
+                        return NGX_CONF_ERROR;
+                }
+
+                *prefix = value[i];
         }
 
-        /* Pass the chain to the next output filter */
-        return ngx_http_next_body_filter(r, in);
+        return NGX_CONF_OK;
 }
 
 
-static void ngx_http_no_newlines_strip_buffer (ngx_buf_t *buffer,
-                                               ngx_http_no_newlines_ctx_t *ctx)
+/* Points each type of a no_newlines_types list to the engine for it */
+static void ngx_http_no_newlines_set_modes (ngx_array_t *types_keys)
 {
-        u_char *reader = NULL;
-        u_char *writer = NULL;
-        u_char *t = NULL;
-        ngx_int_t space_eaten = 0;
-
-        for (writer = buffer->pos, reader = buffer->pos; reader < buffer->last; reader++) {
-                switch(ctx->state) {
-                case state_text_compress:
-
-                        if(ngx_is_space(reader)) {
-                            space_eaten = 1;
-                            reader++;
-                            while (reader < buffer->last && ngx_is_space (reader)) reader++;
-                             if(reader >= buffer->last) /* FIXME: Does it make sense to strip if buffer isn't sanitized? */
-                                goto out;
-                        }
+        ngx_uint_t      i;
+        ngx_hash_key_t *type;
 
-                        /* unless next char is '<', add one space for all eaten */
-                        if (space_eaten && *reader != '<') {
-                                *writer++ = ' ';
-                        }
-                        space_eaten = 0;
+        if (types_keys == NULL || types_keys == NGX_HTTP_NO_NEWLINES_ANY_TYPES) {
+                return;
+        }
 
-                        if(*reader == '>') {
-                                *writer++ = *reader++;
-                                while (reader < buffer->last && ngx_is_space (reader)) {
-                                        reader++;
-                                }
-                                if(reader >= buffer->last)
-                                    goto out;
-                        }
-                        
-                        /* does the next part of the string match the SC_OFF label? */
-                        t = reader;
-                        if ( (buffer->last - reader) >= SC_OFF_LEN
-                            &&
-                             ngx_strncasecmp (t, SC_OFF, SC_OFF_LEN) == 0) {
-                                ctx->state = state_text_no_compress;
-                                reader += SC_OFF_LEN;
-                        }
-                        break;
+        type = types_keys->elts;
 
-                case state_text_no_compress:
-                        /* ignore newlines and whitespace while we are */
-                        /* displaying pre-formatted text */
-                        /* look for SC_ON tag */
-                        t = reader;
-                        if ( (buffer->last - reader) >= SC_ON_LEN
-                             &&
-                             ngx_strncasecmp (t, SC_ON, SC_ON_LEN) == 0) {
-                                ctx->state = state_text_compress;
-                                reader += SC_ON_LEN;
-                        }
-                        break;
+        for (i = 0; i < types_keys->nelts; i++) {
+                type[i].value = ngx_http_no_newlines_type_mode (type[i].key.data,
+                                                                type[i].key.len);
+        }
+}
 
-                default:
-                        break;
+
+static no_newlines_mode_e *ngx_http_no_newlines_type_mode (u_char *type, size_t len)
+{
+        ngx_http_no_newlines_type_t *t;
+
+        for (t = ngx_http_no_newlines_types; t->type.len; t++) {
+                if (len == t->type.len && ngx_strncasecmp (type, t->type.data, len) == 0) {
+                        return &ngx_http_no_newlines_modes[t->mode];
                 }
+        }
 
-                if (reader < buffer->last) {
-                        *writer++ = *reader;
+        for (t = ngx_http_no_newlines_suffixes; t->type.len; t++) {
+                if (len > t->type.len &&
+                    ngx_strncasecmp (type + len - t->type.len, t->type.data,
+                                     t->type.len) == 0) {
+                        return &ngx_http_no_newlines_modes[t->mode];
                 }
         }
-    out:
-        buffer->last = writer;
+
+        return &ngx_http_no_newlines_modes[no_newlines_mode_html];
 }
 
 
-static ngx_int_t ngx_is_space (u_char* c)
+static ngx_int_t ngx_http_no_newlines_filter_init (ngx_conf_t *cf)
 {
-        if (*c == '\n' ||
-            *c == '\r' ||
-            *c == '\t' ||
-            (*c == ' ' && *(c + 1) == ' ')) {
-                /* Leave the last space so that links on the page don't */
-                /* get messed up */
-                return 1;
+        ngx_http_handler_pt       *h;
+        ngx_http_core_main_conf_t *cmcf;
+
+        no_newlines_init_tables ();
+
+        /* registered after the static module, so it is tried first */
+        cmcf = ngx_http_conf_get_module_main_conf (cf, ngx_http_core_module);
+
+        h = ngx_array_push (&cmcf->phases[NGX_HTTP_CONTENT_PHASE].handlers);
+        if (h == NULL) {
+                return NGX_ERROR;
         }
-        return 0;
+
+        *h = ngx_http_no_newlines_static_handler;
+
+        ngx_http_next_header_filter = ngx_http_top_header_filter;
+        ngx_http_top_header_filter = ngx_http_no_newlines_header_filter;
+
+        ngx_http_next_body_filter = ngx_http_top_body_filter;
+        ngx_http_top_body_filter = ngx_http_no_newlines_body_filter;
+
+        return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_no_newlines_init_process (ngx_cycle_t *cycle)
+{
+        ngx_uint_t                         kernel;
+        ngx_http_no_newlines_main_conf_t  *nmcf;
+
+        nmcf = ngx_http_cycle_get_module_main_conf (cycle, ngx_http_no_newlines_module);
+        if (nmcf == NULL) {
+                return NGX_OK;
+        }
+
+        kernel = nmcf->kernel;
+
+        if (!no_newlines_kernel_supported (kernel)) {
+                ngx_log_error (NGX_LOG_WARN, cycle->log, 0,
+                               "no_newlines: \"%s\" kernel is not supported "
+                               "by this CPU, falling back to auto detection",
+                               no_newlines_kernel_name (kernel));
+                kernel = no_newlines_kernel_auto;
+        }
+
+        kernel = no_newlines_use_kernel (kernel);
+
+        ngx_log_error (NGX_LOG_NOTICE, cycle->log, 0,
+                       "no_newlines: using \"%s\" kernel", no_newlines_kernel_name (kernel));
+
+        return NGX_OK;
+}
+
+
+static ngx_int_t ngx_http_no_newlines_header_filter (ngx_http_request_t *r)
+{
+        ngx_int_t                     rc;
+        ngx_str_t                     path;
+        no_newlines_mode_e           *mode;
+        ngx_http_no_newlines_key_t    key;
+        ngx_http_no_newlines_ctx_t   *ctx;  /* to maintain state */
+        ngx_http_no_newlines_conf_t  *conf; /* to check whether module is enabled or not */
+
+        conf = ngx_http_get_module_loc_conf (r, ngx_http_no_newlines_module);
+
+        ctx = ngx_http_get_module_ctx (r, ngx_http_no_newlines_module);
+
+        if (ctx && ctx->minified) {
+                return ngx_http_next_header_filter(r);
+        }
+
+        /* step 1: decide whether to operate */
+        if ((r->headers_out.status != NGX_HTTP_OK &&
+             r->headers_out.status != NGX_HTTP_FORBIDDEN &&
+             r->headers_out.status != NGX_HTTP_NOT_FOUND) ||
+            r->header_only ||
+            r->headers_out.content_type.len == 0 ||
+            (r->headers_out.content_encoding &&
+             r->headers_out.content_encoding->value.len) ||
+            conf->enable == 0) {
+                return ngx_http_next_header_filter(r);
+        }
+
+        mode = ngx_http_test_content_type (r, &conf->types);
+        if (mode == NULL) {
+                return ngx_http_next_header_filter(r);
+        }
+
+        if (conf->types_keys == NGX_HTTP_NO_NEWLINES_ANY_TYPES) {
+                /* "*" leaves no hash to look the engine up in */
+                mode = ngx_http_no_newlines_type_mode (r->headers_out.content_type.data,
+                                                       r->headers_out.content_type_len);
+        }
+
+        /* step 2: operate on the header */
+        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_no_newlines_ctx_t));
+        if (ctx == NULL) {
+                return NGX_ERROR;
+        }
+
+        no_newlines_init (&ctx->nl, *mode, conf->engine);
+
+        ngx_http_set_ctx(r, ctx, ngx_http_no_newlines_module);
+
+        rc = NGX_DECLINED;
+
+        if (conf->cache || conf->store) {
+                rc = ngx_http_no_newlines_file_key (r, &key, &path);
+        }
+
+        if (rc == NGX_OK) {
+                key.mode = *mode;
+                key.options = conf->options;
+
+                rc = NGX_DECLINED;
+
+                if (conf->cache) {
+                        rc = ngx_http_no_newlines_cache_lookup (r, ctx, conf->cache, &key);
+                }
+
+                if (rc == NGX_DECLINED && conf->store) {
+                        rc = ngx_http_no_newlines_store_lookup (r, ctx, conf->store, &key, &path);
+                }
+        }
+
+        if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+        }
+
+        ngx_http_clear_accept_ranges(r);
+
+        if (rc == NGX_OK) {
+                /* the stripped body is at hand, so its length is known, */
+                /* and the file does not even have to be read */
+                r->headers_out.content_length_n = ctx->cached ? (off_t) ctx->cached->len
+                                                              : ctx->stored->file_last;
+                if (r->headers_out.content_length) {
+                        r->headers_out.content_length->hash = 0;
+                        r->headers_out.content_length = NULL;
+                }
+
+        } else {
+                ngx_http_clear_content_length(r);
+                r->main_filter_need_in_memory = 1;
+        }
+
+        /* step 3: call the next filter */
+        return ngx_http_next_header_filter(r);
+}
+
+
+/*
+ * Sends foo.min.html for foo.html when the former is at least as new,
+ * in the manner of gzip_static; the file is sent without being stripped.
+ */
+static ngx_int_t ngx_http_no_newlines_static_handler (ngx_http_request_t *r)
+{
+        u_char                      *p, *last;
+        size_t                       root;
+        ngx_int_t                    rc;
+        ngx_str_t                    path;
+        ngx_buf_t                   *b;
+        ngx_uint_t                   level;
+        ngx_log_t                   *log;
+        ngx_chain_t                  out;
+        ngx_file_info_t              fi;
+        ngx_open_file_info_t         of;
+        ngx_http_core_loc_conf_t    *clcf;
+        ngx_http_no_newlines_ctx_t  *ctx;
+        ngx_http_no_newlines_conf_t *conf;
+
+        if (!(r->method & (NGX_HTTP_GET | NGX_HTTP_HEAD))) {
+                return NGX_DECLINED;
+        }
+
+        if (r->uri.data[r->uri.len - 1] == '/' || r->exten.len == 0) {
+                return NGX_DECLINED;
+        }
+
+        conf = ngx_http_get_module_loc_conf (r, ngx_http_no_newlines_module);
+
+        if (!conf->minified) {
+                return NGX_DECLINED;
+        }
+
+        /* only files of the types stripped have siblings looked for */
+        rc = ngx_http_no_newlines_static_type (r, &conf->types);
+        if (rc != NGX_OK) {
+                return (rc == NGX_DECLINED) ? NGX_DECLINED : NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        log = r->connection->log;
+
+        last = ngx_http_map_uri_to_path (r, &path, &root, sizeof("min.") - 1);
+        if (last == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        path.len = last - path.data;
+
+        /* the file being replaced must be there, and not be newer */
+        if (ngx_file_info (path.data, &fi) == NGX_FILE_ERROR || !ngx_is_file (&fi)) {
+                return NGX_DECLINED;
+        }
+
+        /* foo.html becomes foo.min.html */
+        p = last - r->exten.len;
+
+        if (p <= path.data || p[-1] != '.') {
+                return NGX_DECLINED;
+        }
+
+        ngx_memmove (p + sizeof("min.") - 1, p, r->exten.len + 1);
+        ngx_memcpy (p, "min.", sizeof("min.") - 1);
+        path.len += sizeof("min.") - 1;
+
+        ngx_log_debug1 (NGX_LOG_DEBUG_HTTP, log, 0,
+                        "http no_newlines filename: \"%V\"", &path);
+
+        clcf = ngx_http_get_module_loc_conf (r, ngx_http_core_module);
+
+        ngx_memzero (&of, sizeof(ngx_open_file_info_t));
+
+        of.read_ahead = clcf->read_ahead;
+        of.directio = clcf->directio;
+        of.valid = clcf->open_file_cache_valid;
+        of.min_uses = clcf->open_file_cache_min_uses;
+        of.errors = clcf->open_file_cache_errors;
+        of.events = clcf->open_file_cache_events;
+
+        if (ngx_http_set_disable_symlinks (r, clcf, &path, &of) != NGX_OK) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (ngx_open_cached_file (clcf->open_file_cache, &path, &of, r->pool) != NGX_OK) {
+                switch (of.err) {
+
+                case 0:
+                        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+                case NGX_ENOENT:
+                case NGX_ENOTDIR:
+                case NGX_ENAMETOOLONG:
+                        return NGX_DECLINED;
+
+#if (NGX_HAVE_OPENAT)
+                case NGX_EMLINK:
+                case NGX_ELOOP:
+#endif
+                case NGX_EACCES:
+                        level = NGX_LOG_ERR;
+                        break;
+
+                default:
+                        level = NGX_LOG_CRIT;
+                        break;
+                }
+
+                ngx_log_error (level, log, of.err,
+                               "%s \"%s\" failed", of.failed, path.data);
+
+                return NGX_DECLINED;
+        }
+
+        if (of.is_dir || !of.is_file || of.mtime < ngx_file_mtime (&fi)) {
+                return NGX_DECLINED;
+        }
+
+        rc = ngx_http_discard_request_body (r);
+        if (rc != NGX_OK) {
+                return rc;
+        }
+
+        log->action = "sending response to client";
+
+        r->headers_out.status = NGX_HTTP_OK;
+        r->headers_out.content_length_n = of.size;
+        r->headers_out.last_modified_time = of.mtime;
+
+        if (ngx_http_set_etag (r) != NGX_OK) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (ngx_http_set_content_type (r) != NGX_OK) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        r->allow_ranges = 1;
+
+        /* keeps our own filters out of the way */
+        ctx = ngx_pcalloc (r->pool, sizeof(ngx_http_no_newlines_ctx_t));
+        if (ctx == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ctx->minified = 1;
+
+        ngx_http_set_ctx (r, ctx, ngx_http_no_newlines_module);
+
+        b = ngx_calloc_buf (r->pool);
+        if (b == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        b->file = ngx_pcalloc (r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        rc = ngx_http_send_header (r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+                return rc;
+        }
+
+        b->file_pos = 0;
+        b->file_last = of.size;
+
+        b->in_file = b->file_last ? 1 : 0;
+        b->last_buf = (r == r->main) ? 1 : 0;
+        b->last_in_chain = 1;
+        b->sync = (b->last_buf || b->in_file) ? 0 : 1;
+
+        b->file->fd = of.fd;
+        b->file->name = path;
+        b->file->log = log;
+        b->file->directio = of.is_directio;
+
+        out.buf = b;
+        out.next = NULL;
+
+        return ngx_http_output_filter (r, &out);
+}
+
+
+/*
+ * Tells whether the type that the extension maps to, as the file would be
+ * sent with, is one of those stripped.  The type is looked up as
+ * ngx_http_set_content_type() does, but not set, as the request may yet
+ * go to another handler.
+ */
+static ngx_int_t ngx_http_no_newlines_static_type (ngx_http_request_t *r,
+                                                   ngx_hash_t *types)
+{
+        u_char                    *low;
+        ngx_str_t                 *type;
+        ngx_uint_t                 hash;
+        ngx_http_core_loc_conf_t  *clcf;
+
+        /* "*" */
+        if (types->size == 0) {
+                return NGX_OK;
+        }
+
+        clcf = ngx_http_get_module_loc_conf (r, ngx_http_core_module);
+
+        low = ngx_pnalloc (r->pool, r->exten.len);
+        if (low == NULL) {
+                return NGX_ERROR;
+        }
+
+        hash = ngx_hash_strlow (low, r->exten.data, r->exten.len);
+
+        type = ngx_hash_find (&clcf->types_hash, hash, low, r->exten.len);
+        if (type == NULL) {
+                type = &clcf->default_type;
+        }
+
+        if (type->len == 0) {
+                return NGX_DECLINED;
+        }
+
+        low = ngx_pnalloc (r->pool, type->len);
+        if (low == NULL) {
+                return NGX_ERROR;
+        }
+
+        hash = ngx_hash_strlow (low, type->data, type->len);
+
+        return ngx_hash_find (types, hash, low, type->len) ? NGX_OK : NGX_DECLINED;
+}
+
+
+static ngx_int_t ngx_http_no_newlines_body_filter (ngx_http_request_t *r,
+                                                   ngx_chain_t *in)
+{
+        ngx_int_t                   rc;
+        ngx_buf_t                  *b;
+        ngx_chain_t                *chain_link;
+        ngx_http_no_newlines_ctx_t *ctx;
+
+        /* Get the current context */
+        ctx = ngx_http_get_module_ctx (r, ngx_http_no_newlines_module);
+
+        if (ctx == NULL || ctx->minified) {
+                return ngx_http_next_body_filter(r, in);
+        }
+
+        if (ctx->cached || ctx->stored) {
+                return ngx_http_no_newlines_replace (r, ctx, in);
+        }
+
+        if (in == NULL && ctx->in == NULL && ctx->busy == NULL) {
+                return ngx_http_next_body_filter(r, in);
+        }
+
+        /* The links of "in" belong to the caller, who may be tracking them */
+        /* as busy, so they are copied; the output goes out in a chain of */
+        /* our own */
+        if (in) {
+                if (ngx_chain_add_copy (r->pool, &ctx->in, in) != NGX_OK) {
+                        return NGX_ERROR;
+                }
+        }
+
+        for ( ;; ) {
+                ctx->out = NULL;
+                ctx->last_out = &ctx->out;
+
+                /* For each buffer in the chain link, remove all the newlines */
+                while (ctx->in) {
+                        b = ctx->in->buf;
+
+                        if (b->temporary && no_newlines_pending (&ctx->nl) == 0) {
+                                /* the buffer may be written to, and nothing */
+                                /* is pending from the previous one, so the */
+                                /* output fits over the input */
+                                if (ctx->buf && ctx->buf->pos != ctx->buf->last
+                                    && ngx_http_no_newlines_link (r, ctx, ctx->buf) != NGX_OK) {
+                                        return NGX_ERROR;
+                                }
+
+                                b->last = no_newlines_feed (&ctx->nl, b->pos, b->last - b->pos,
+                                                            b->pos);
+                                if (b->last_buf || b->last_in_chain) {
+                                        b->last = no_newlines_finish (&ctx->nl, b->last);
+                                }
+
+                                /* the file range, if any, still holds the */
+                                /* bytes as they were */
+                                b->in_file = 0;
+
+                                if (b->pos != b->last) {
+                                        rc = ngx_http_no_newlines_link (r, ctx, b);
+                                } else {
+                                        rc = ngx_http_no_newlines_link_flags (r, ctx, b);
+                                }
+
+                        } else {
+                                /* memory that is not ours to change, such as */
+                                /* a file mapped or a response body from the */
+                                /* configuration, a buffer that cannot take */
+                                /* the bytes still owed, or one carrying only */
+                                /* flags */
+                                rc = ngx_http_no_newlines_copy (r, ctx, b);
+                        }
+
+                        if (rc == NGX_ERROR) {
+                                return NGX_ERROR;
+                        }
+
+                        if (rc == NGX_AGAIN) {
+                                /* all output buffers are in use */
+                                break;
+                        }
+
+                        chain_link = ctx->in;
+                        ctx->in = chain_link->next;
+                        ngx_free_chain (r->pool, chain_link);
+                }
+
+                /* whatever has been produced is sent now */
+                if (ctx->buf && ctx->buf->pos != ctx->buf->last) {
+                        if (ngx_http_no_newlines_link (r, ctx, ctx->buf) != NGX_OK) {
+                                return NGX_ERROR;
+                        }
+                }
+
+                if (ctx->out == NULL && ctx->busy == NULL && ctx->in == NULL) {
+                        return NGX_OK;
+                }
+
+                /* Pass the chain to the next output filter */
+                rc = ngx_http_next_body_filter(r, ctx->out);
+
+                ngx_chain_update_chains (r->pool, &ctx->free, &ctx->busy, &ctx->out,
+                                         (ngx_buf_tag_t) &ngx_http_no_newlines_module);
+
+                if (rc == NGX_ERROR) {
+                        return NGX_ERROR;
+                }
+
+                if (ctx->in == NULL) {
+                        return rc;
+                }
+
+                if (ctx->free == NULL) {
+                        /* nothing was sent; the rest waits in ctx->in for */
+                        /* the writer to call us again.  No bit is set in */
+                        /* r->buffered: its four are taken by SSI, sub, copy */
+                        /* and image, and sharing one would clear theirs. */
+                        /* None is needed either, as the filter that holds */
+                        /* all our output buffers, the write filter, gzip, */
+                        /* SSI, sub or postpone, marks the request or the */
+                        /* connection buffered itself. */
+                        return NGX_AGAIN;
+                }
+        }
+}
+
+
+/*
+ * Strips the contents of b into output buffers of our own, consuming b as
+ * it goes so that whoever owns it may reuse it at once.  Returns NGX_AGAIN
+ * if all output buffers are in use before b is done with.
+ */
+static ngx_int_t ngx_http_no_newlines_copy (ngx_http_request_t *r,
+                                            ngx_http_no_newlines_ctx_t *ctx,
+                                            ngx_buf_t *b)
+{
+        size_t     size;
+        ngx_int_t  rc;
+
+        while (b->pos < b->last) {
+                rc = ngx_http_no_newlines_get_buf (r, ctx);
+                if (rc != NGX_OK) {
+                        return rc;
+                }
+
+                /* the output of n bytes is at most n bytes plus those owed */
+                size = ctx->buf->end - ctx->buf->last
+                       - no_newlines_pending (&ctx->nl) - 1;
+                size = ngx_min (size, (size_t) (b->last - b->pos));
+
+                ctx->buf->last = no_newlines_feed (&ctx->nl, b->pos, size, ctx->buf->last);
+                b->pos += size;
+
+                if ((size_t) (ctx->buf->end - ctx->buf->last) <= NO_NEWLINES_PENDING_MAX + 2) {
+                        if (ngx_http_no_newlines_link (r, ctx, ctx->buf) != NGX_OK) {
+                                return NGX_ERROR;
+                        }
+                }
+        }
+
+        if ((b->last_buf || b->last_in_chain) && no_newlines_pending (&ctx->nl)) {
+                /* there is always room for these in a buffer being filled */
+                rc = ngx_http_no_newlines_get_buf (r, ctx);
+                if (rc != NGX_OK) {
+                        return rc;
+                }
+
+                ctx->buf->last = no_newlines_finish (&ctx->nl, ctx->buf->last);
+        }
+
+        return ngx_http_no_newlines_link_flags (r, ctx, b);
+}
+
+
+/*
+ * Makes sure that ctx->buf is an output buffer with room to write to,
+ * reusing a buffer that has been sent if there is one.  Returns NGX_AGAIN
+ * if all the buffers that no_newlines_buffers allows are in use.
+ */
+static ngx_int_t ngx_http_no_newlines_get_buf (ngx_http_request_t *r,
+                                               ngx_http_no_newlines_ctx_t *ctx)
+{
+        ngx_buf_t                    *b;
+        ngx_chain_t                  *cl;
+        ngx_http_no_newlines_conf_t  *conf;
+
+        if (ctx->buf) {
+                return NGX_OK;
+        }
+
+        if (ctx->free) {
+                cl = ctx->free;
+                ctx->free = cl->next;
+
+                b = cl->buf;
+                ngx_free_chain (r->pool, cl);
+
+                b->pos = b->start;
+                b->last = b->start;
+                b->last_buf = 0;
+                b->last_in_chain = 0;
+                b->flush = 0;
+                b->sync = 0;
+
+        } else {
+                conf = ngx_http_get_module_loc_conf (r, ngx_http_no_newlines_module);
+
+                if (ctx->bufs >= conf->bufs.num) {
+                        return NGX_AGAIN;
+                }
+
+                b = ngx_create_temp_buf (r->pool, conf->bufs.size);
+                if (b == NULL) {
+                        return NGX_ERROR;
+                }
+
+                b->tag = (ngx_buf_tag_t) &ngx_http_no_newlines_module;
+                b->recycled = 1;
+
+                ctx->bufs++;
+        }
+
+        ctx->buf = b;
+
+        return NGX_OK;
+}
+
+
+/* Appends b to the output; an output buffer of our own is done with */
+static ngx_int_t ngx_http_no_newlines_link (ngx_http_request_t *r,
+                                            ngx_http_no_newlines_ctx_t *ctx,
+                                            ngx_buf_t *b)
+{
+        ngx_chain_t  *cl;
+
+        if (b == ctx->buf) {
+                ctx->buf = NULL;
+        }
+
+        if (ctx->fill) {
+                ngx_http_no_newlines_cache_append (ctx, b);
+
+                if (ctx->fill && (b->last_buf || b->last_in_chain)) {
+                        ngx_http_no_newlines_cache_commit (ctx);
+                }
+        }
+
+        if (ctx->temp) {
+                ngx_http_no_newlines_store_append (ctx, b);
+
+                if (ctx->temp && (b->last_buf || b->last_in_chain)) {
+                        ngx_http_no_newlines_store_commit (r, ctx);
+                }
+        }
+
+        cl = ngx_alloc_chain_link (r->pool);
+        if (cl == NULL) {
+                return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        return NGX_OK;
+}
+
+
+/*
+ * Passes on the flags of b, whose contents have been consumed: along with
+ * the output buffer being filled if there is one, or else in a buffer of
+ * their own.
+ */
+static ngx_int_t ngx_http_no_newlines_link_flags (ngx_http_request_t *r,
+                                                  ngx_http_no_newlines_ctx_t *ctx,
+                                                  ngx_buf_t *b)
+{
+        ngx_buf_t  *nb;
+
+        if (!b->last_buf && !b->last_in_chain && !b->flush && !b->sync) {
+                return NGX_OK;
+        }
+
+        if (ctx->buf && ctx->buf->pos != ctx->buf->last) {
+                nb = ctx->buf;
+
+        } else if (!ngx_buf_in_memory (b)) {
+                nb = b;
+
+        } else {
+                nb = ngx_calloc_buf (r->pool);
+                if (nb == NULL) {
+                        return NGX_ERROR;
+                }
+        }
+
+        nb->last_buf = b->last_buf;
+        nb->last_in_chain = b->last_in_chain;
+        nb->flush = b->flush;
+        nb->sync = b->sync;
+
+        return ngx_http_no_newlines_link (r, ctx, nb);
+}
+
+
+static char *ngx_http_no_newlines_cache (ngx_conf_t *cf, ngx_command_t *cmd,
+                                         void *conf)
+{
+        ngx_http_no_newlines_conf_t *nlcf = conf;
+
+        u_char                       *p;
+        ssize_t                       size;
+        ngx_str_t                    *value, name, s;
+        ngx_http_no_newlines_cache_t *cache;
+
+        if (nlcf->cache != NGX_CONF_UNSET_PTR) {
+                return "is duplicate";
+        }
+
+        value = cf->args->elts;
+
+        if (ngx_strcmp (value[1].data, "off") == 0) {
+                nlcf->cache = NULL;
+                return NGX_CONF_OK;
+        }
+
+        if (ngx_strncmp (value[1].data, "zone=", 5) != 0) {
+                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                    "invalid parameter \"%V\"", &value[1]);
+                return NGX_CONF_ERROR;
+        }
+
+        /* "zone=name:size" defines a zone, "zone=name" refers to one */
+        name.data = value[1].data + 5;
+        p = (u_char *) ngx_strchr (name.data, ':');
+
+        if (p) {
+                name.len = p - name.data;
+
+                s.data = p + 1;
+                s.len = value[1].data + value[1].len - s.data;
+
+                size = ngx_parse_size (&s);
+                if (size == NGX_ERROR) {
+                        ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                            "invalid zone size \"%V\"", &value[1]);
+                        return NGX_CONF_ERROR;
+                }
+
+                if (size < (ssize_t) (8 * ngx_pagesize)) {
+                        ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                            "zone \"%V\" is too small", &value[1]);
+                        return NGX_CONF_ERROR;
+                }
+
+        } else {
+                name.len = value[1].len - 5;
+                size = 0;
+        }
+
+        if (name.len == 0) {
+                ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                    "invalid zone name \"%V\"", &value[1]);
+                return NGX_CONF_ERROR;
+        }
+
+        nlcf->cache = ngx_shared_memory_add (cf, &name, size, &ngx_http_no_newlines_module);
+        if (nlcf->cache == NULL) {
+                return NGX_CONF_ERROR;
+        }
+
+        if (nlcf->cache->data == NULL) {
+                cache = ngx_pcalloc (cf->pool, sizeof(ngx_http_no_newlines_cache_t));
+                if (cache == NULL) {
+                        return NGX_CONF_ERROR;
+                }
+
+                nlcf->cache->init = ngx_http_no_newlines_cache_init_zone;
+                nlcf->cache->data = cache;
+        }
+
+        return NGX_CONF_OK;
+}
+
+
+static ngx_int_t ngx_http_no_newlines_cache_init_zone (ngx_shm_zone_t *shm_zone,
+                                                       void *data)
+{
+        ngx_http_no_newlines_cache_t *ocache = data;
+
+        size_t                        len;
+        ngx_http_no_newlines_cache_t *cache;
+
+        cache = shm_zone->data;
+
+        /* a body takes at most a quarter of the zone */
+        cache->max_size = shm_zone->shm.size / 4;
+
+        if (ocache) {
+                cache->sh = ocache->sh;
+                cache->shpool = ocache->shpool;
+                return NGX_OK;
+        }
+
+        cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+        if (shm_zone->shm.exists) {
+                cache->sh = cache->shpool->data;
+                return NGX_OK;
+        }
+
+        cache->sh = ngx_slab_alloc (cache->shpool, sizeof(ngx_http_no_newlines_cache_sh_t));
+        if (cache->sh == NULL) {
+                return NGX_ERROR;
+        }
+
+        cache->shpool->data = cache->sh;
+
+        ngx_rbtree_init (&cache->sh->rbtree, &cache->sh->sentinel,
+                         ngx_http_no_newlines_cache_insert_value);
+        ngx_queue_init (&cache->sh->queue);
+
+        len = sizeof(" in no_newlines_cache zone \"\"") + shm_zone->shm.name.len;
+
+        cache->shpool->log_ctx = ngx_slab_alloc (cache->shpool, len);
+        if (cache->shpool->log_ctx == NULL) {
+                return NGX_ERROR;
+        }
+
+        ngx_sprintf (cache->shpool->log_ctx, " in no_newlines_cache zone \"%V\"%Z",
+                     &shm_zone->shm.name);
+
+        /* running out of memory is dealt with by evicting bodies */
+        cache->shpool->log_nomem = 0;
+
+        return NGX_OK;
+}
+
+
+/*
+ * Identifies the static file being sent.  Returns NGX_DECLINED if the
+ * response is not a complete file as sent by the static module, or the
+ * file has changed since it was opened.
+ */
+static ngx_int_t ngx_http_no_newlines_file_key (ngx_http_request_t *r,
+                                                ngx_http_no_newlines_key_t *key,
+                                                ngx_str_t *path)
+{
+        u_char          *last;
+        size_t           root;
+        ngx_file_info_t  fi;
+
+        if (r->headers_out.status != NGX_HTTP_OK
+            || r->headers_out.last_modified_time == -1
+            || r->headers_out.content_length_n < 0) {
+                return NGX_DECLINED;
+        }
+
+        last = ngx_http_map_uri_to_path (r, path, &root, 0);
+        if (last == NULL) {
+                return NGX_ERROR;
+        }
+
+        path->len = last - path->data;
+
+        if (ngx_file_info (path->data, &fi) == NGX_FILE_ERROR
+            || !ngx_is_file (&fi)
+            || ngx_file_mtime (&fi) != r->headers_out.last_modified_time
+            || ngx_file_size (&fi) != r->headers_out.content_length_n) {
+                return NGX_DECLINED;
+        }
+
+        ngx_memzero (key, sizeof(ngx_http_no_newlines_key_t));
+        key->uniq = ngx_file_uniq (&fi);
+        key->mtime = ngx_file_mtime (&fi);
+        key->size = ngx_file_size (&fi);
+
+        return NGX_OK;
+}
+
+
+/* Sends the stripped body in place of the file, which is skipped unread */
+static ngx_int_t ngx_http_no_newlines_replace (ngx_http_request_t *r,
+                                               ngx_http_no_newlines_ctx_t *ctx,
+                                               ngx_chain_t *in)
+{
+        ngx_buf_t   *b;
+        ngx_chain_t *cl, out;
+
+        for (cl = in; cl; cl = cl->next) {
+                b = cl->buf;
+
+                if (ngx_buf_in_memory (b)) {
+                        b->pos = b->last;
+                }
+
+                if (b->in_file) {
+                        b->file_pos = b->file_last;
+                }
+
+                if (!b->last_buf && !b->last_in_chain) {
+                        continue;
+                }
+
+                if (ctx->stored) {
+                        b = ctx->stored;
+
+                        /* the copy filter has run already, so what it */
+                        /* would have read is read here: for the filters */
+                        /* after this one, such as gzip, SSI or sub, that */
+                        /* only look at what is in memory, and when the */
+                        /* file cannot be sent as it is, without sendfile, */
+                        /* over SSL or with directio */
+                        if (b->in_file && ngx_http_no_newlines_store_in_memory (r, b)) {
+                                b->last_buf = cl->buf->last_buf;
+                                b->last_in_chain = cl->buf->last_in_chain;
+                                ctx->reading = 1;
+                                break;
+                        }
+
+                } else {
+                        b = ngx_calloc_buf (r->pool);
+                        if (b == NULL) {
+                                return NGX_ERROR;
+                        }
+
+                        if (ctx->cached->len) {
+                                b->memory = 1;
+                                b->pos = ctx->cached->data;
+                                b->last = ctx->cached->data + ctx->cached->len;
+                        }
+                }
+
+                b->last_buf = cl->buf->last_buf;
+                b->last_in_chain = cl->buf->last_in_chain;
+
+                out.buf = b;
+                out.next = NULL;
+
+                return ngx_http_next_body_filter (r, &out);
+        }
+
+        if (ctx->reading) {
+                return ngx_http_no_newlines_store_send (r, ctx);
+        }
+
+        return ngx_http_next_body_filter (r, NULL);
+}
+
+
+/*
+ * Looks for the stripped body of the file in the cache.  Returns NGX_OK if
+ * it is there, and NGX_DECLINED if it is not; in that case room is set
+ * aside for the body, to be filled as the response is stripped.
+ */
+static ngx_int_t ngx_http_no_newlines_cache_lookup (ngx_http_request_t *r,
+                                                    ngx_http_no_newlines_ctx_t *ctx,
+                                                    ngx_shm_zone_t *zone,
+                                                    ngx_http_no_newlines_key_t *key)
+{
+        uint32_t                           hash;
+        ngx_pool_cleanup_t                *cln;
+        ngx_http_no_newlines_cache_t      *cache;
+        ngx_http_no_newlines_cache_node_t *node;
+
+        cache = zone->data;
+
+        if ((size_t) key->size > cache->max_size) {
+                return NGX_DECLINED;
+        }
+
+        hash = ngx_crc32_short ((u_char *) key, sizeof(ngx_http_no_newlines_key_t));
+
+        cln = ngx_pool_cleanup_add (r->pool, 0);
+        if (cln == NULL) {
+                return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_no_newlines_cache_cleanup;
+        cln->data = ctx;
+
+        ctx->cache = cache;
+
+        ngx_shmtx_lock (&cache->shpool->mutex);
+
+        node = ngx_http_no_newlines_cache_find (cache, key, hash);
+
+        if (node) {
+                /* the body stays put while it is being sent */
+                node->count++;
+
+                ngx_queue_remove (&node->queue);
+                ngx_queue_insert_head (&cache->sh->queue, &node->queue);
+
+                ngx_shmtx_unlock (&cache->shpool->mutex);
+
+                ctx->cached = node;
+
+                return NGX_OK;
+        }
+
+        /* the stripped body is never longer than the file */
+        node = ngx_http_no_newlines_cache_alloc (cache,
+                       offsetof(ngx_http_no_newlines_cache_node_t, data) + key->size);
+
+        ngx_shmtx_unlock (&cache->shpool->mutex);
+
+        if (node) {
+                node->node.key = hash;
+                node->key = *key;
+                node->count = 0;
+                node->len = 0;
+
+                ctx->fill = node;
+                ctx->fill_size = key->size;
+        }
+
+        return NGX_DECLINED;
+}
+
+
+/* Copies the output in b to the body being stored */
+static void ngx_http_no_newlines_cache_append (ngx_http_no_newlines_ctx_t *ctx,
+                                               ngx_buf_t *b)
+{
+        size_t size;
+
+        if (!ngx_buf_in_memory (b)) {
+                return;
+        }
+
+        size = b->last - b->pos;
+
+        if (ctx->fill->len + size > ctx->fill_size) {
+                /* the file must have changed while it was being read */
+                ngx_shmtx_lock (&ctx->cache->shpool->mutex);
+                ngx_slab_free_locked (ctx->cache->shpool, ctx->fill);
+                ngx_shmtx_unlock (&ctx->cache->shpool->mutex);
+
+                ctx->fill = NULL;
+                return;
+        }
+
+        ngx_memcpy (ctx->fill->data + ctx->fill->len, b->pos, size);
+        ctx->fill->len += size;
+}
+
+
+/* Makes the body being stored visible to all workers */
+static void ngx_http_no_newlines_cache_commit (ngx_http_no_newlines_ctx_t *ctx)
+{
+        ngx_http_no_newlines_cache_t      *cache;
+        ngx_http_no_newlines_cache_node_t *node, *exact;
+
+        cache = ctx->cache;
+        node = ctx->fill;
+        ctx->fill = NULL;
+
+        ngx_shmtx_lock (&cache->shpool->mutex);
+
+        if (ngx_http_no_newlines_cache_find (cache, &node->key, node->node.key)) {
+                /* another request has stored it meanwhile */
+                ngx_slab_free_locked (cache->shpool, node);
+                ngx_shmtx_unlock (&cache->shpool->mutex);
+                return;
+        }
+
+        /* give back the room that the stripping saved */
+        if (node->len < ctx->fill_size) {
+                exact = ngx_slab_alloc_locked (cache->shpool,
+                                offsetof(ngx_http_no_newlines_cache_node_t, data) + node->len);
+                if (exact) {
+                        ngx_memcpy (exact, node,
+                                    offsetof(ngx_http_no_newlines_cache_node_t, data) + node->len);
+                        ngx_slab_free_locked (cache->shpool, node);
+                        node = exact;
+                }
+        }
+
+        ngx_rbtree_insert (&cache->sh->rbtree, &node->node);
+        ngx_queue_insert_head (&cache->sh->queue, &node->queue);
+
+        ngx_shmtx_unlock (&cache->shpool->mutex);
+}
+
+
+static void ngx_http_no_newlines_cache_cleanup (void *data)
+{
+        ngx_http_no_newlines_ctx_t *ctx = data;
+
+        if (ctx->cached == NULL && ctx->fill == NULL) {
+                return;
+        }
+
+        ngx_shmtx_lock (&ctx->cache->shpool->mutex);
+
+        if (ctx->cached) {
+                ctx->cached->count--;
+        }
+
+        if (ctx->fill) {
+                /* the response did not complete */
+                ngx_slab_free_locked (ctx->cache->shpool, ctx->fill);
+        }
+
+        ngx_shmtx_unlock (&ctx->cache->shpool->mutex);
+}
+
+
+static ngx_http_no_newlines_cache_node_t *ngx_http_no_newlines_cache_find (
+        ngx_http_no_newlines_cache_t *cache, ngx_http_no_newlines_key_t *key,
+        uint32_t hash)
+{
+        ngx_int_t                          rc;
+        ngx_rbtree_node_t                 *node, *sentinel;
+        ngx_http_no_newlines_cache_node_t *cn;
+
+        node = cache->sh->rbtree.root;
+        sentinel = cache->sh->rbtree.sentinel;
+
+        while (node != sentinel) {
+
+                if (hash < node->key) {
+                        node = node->left;
+                        continue;
+                }
+
+                if (hash > node->key) {
+                        node = node->right;
+                        continue;
+                }
+
+                /* hash == node->key */
+
+                cn = (ngx_http_no_newlines_cache_node_t *) node;
+
+                rc = ngx_memcmp (key, &cn->key, sizeof(ngx_http_no_newlines_key_t));
+
+                if (rc == 0) {
+                        return cn;
+                }
+
+                node = (rc < 0) ? node->left : node->right;
+        }
+
+        return NULL;
+}
+
+
+/*
+ * Allocates from the zone, evicting the least recently used bodies that
+ * are not being sent until the allocation succeeds.  Called locked.
+ */
+static void *ngx_http_no_newlines_cache_alloc (ngx_http_no_newlines_cache_t *cache,
+                                               size_t size)
+{
+        void                              *p;
+        ngx_queue_t                       *q;
+        ngx_http_no_newlines_cache_node_t *cn;
+
+        for ( ;; ) {
+                p = ngx_slab_alloc_locked (cache->shpool, size);
+                if (p) {
+                        return p;
+                }
+
+                for (q = ngx_queue_last (&cache->sh->queue);
+                     q != ngx_queue_sentinel (&cache->sh->queue);
+                     q = ngx_queue_prev (q))
+                {
+                        cn = ngx_queue_data (q, ngx_http_no_newlines_cache_node_t, queue);
+
+                        if (cn->count == 0) {
+                                break;
+                        }
+                }
+
+                if (q == ngx_queue_sentinel (&cache->sh->queue)) {
+                        return NULL;
+                }
+
+                ngx_queue_remove (&cn->queue);
+                ngx_rbtree_delete (&cache->sh->rbtree, &cn->node);
+                ngx_slab_free_locked (cache->shpool, cn);
+        }
+}
+
+
+static void ngx_http_no_newlines_cache_insert_value (ngx_rbtree_node_t *temp,
+                                                     ngx_rbtree_node_t *node,
+                                                     ngx_rbtree_node_t *sentinel)
+{
+        ngx_rbtree_node_t                **p;
+        ngx_http_no_newlines_cache_node_t *cn, *cnt;
+
+        for ( ;; ) {
+
+                if (node->key < temp->key) {
+                        p = &temp->left;
+
+                } else if (node->key > temp->key) {
+                        p = &temp->right;
+
+                } else { /* node->key == temp->key */
+
+                        cn = (ngx_http_no_newlines_cache_node_t *) node;
+                        cnt = (ngx_http_no_newlines_cache_node_t *) temp;
+
+                        p = (ngx_memcmp (&cn->key, &cnt->key,
+                                         sizeof(ngx_http_no_newlines_key_t)) < 0)
+                            ? &temp->left : &temp->right;
+                }
+
+                if (*p == sentinel) {
+                        break;
+                }
+
+                temp = *p;
+        }
+
+        *p = node;
+        node->parent = temp;
+        node->left = sentinel;
+        node->right = sentinel;
+        ngx_rbt_red (node);
+}
+
+
+static char *ngx_http_no_newlines_store (ngx_conf_t *cf, ngx_command_t *cmd,
+                                         void *conf)
+{
+        ngx_http_no_newlines_conf_t *nlcf = conf;
+
+        u_char     *p, *last;
+        ngx_uint_t  i, n;
+        ngx_str_t  *value;
+        ngx_path_t *path;
+
+        if (nlcf->store != NGX_CONF_UNSET_PTR) {
+                return "is duplicate";
+        }
+
+        value = cf->args->elts;
+
+        if (cf->args->nelts == 2 && ngx_strcmp (value[1].data, "off") == 0) {
+                nlcf->store = NULL;
+                return NGX_CONF_OK;
+        }
+
+        path = ngx_pcalloc (cf->pool, sizeof(ngx_path_t));
+        if (path == NULL) {
+                return NGX_CONF_ERROR;
+        }
+
+        path->name = value[1];
+
+        if (path->name.len > 1 && path->name.data[path->name.len - 1] == '/') {
+                path->name.len--;
+        }
+
+        if (ngx_conf_full_name (cf->cycle, &path->name, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+        }
+
+        for (i = 2; i < cf->args->nelts; i++) {
+
+                if (ngx_strncmp (value[i].data, "levels=", 7) != 0) {
+                        ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                            "invalid parameter \"%V\"", &value[i]);
+                        return NGX_CONF_ERROR;
+                }
+
+                /* as in proxy_cache_path: up to three levels of 1 or 2 */
+                p = value[i].data + 7;
+                last = value[i].data + value[i].len;
+
+                for (n = 0; n < NGX_MAX_PATH_LEVEL && p < last; n++) {
+
+                        if (*p < '1' || *p > '2') {
+                                break;
+                        }
+
+                        path->level[n] = *p++ - '0';
+                        path->len += path->level[n] + 1;
+
+                        if (p == last) {
+                                break;
+                        }
+
+                        if (*p++ != ':' || p == last) {
+                                n = NGX_MAX_PATH_LEVEL;
+                                break;
+                        }
+                }
+
+                if (p != last || n == NGX_MAX_PATH_LEVEL) {
+                        ngx_conf_log_error (NGX_LOG_EMERG, cf, 0,
+                                            "invalid \"levels\" \"%V\"", &value[i]);
+                        return NGX_CONF_ERROR;
+                }
+        }
+
+        path->conf_file = cf->conf_file->file.name.data;
+        path->line = cf->conf_file->line;
+
+        if (ngx_add_path (cf, &path) != NGX_OK) {
+                return NGX_CONF_ERROR;
+        }
+
+        nlcf->store = path;
+
+        return NGX_CONF_OK;
+}
+
+
+/*
+ * Looks for the stripped body of the file in the store.  Returns NGX_OK if
+ * it is there, and NGX_DECLINED if it is not; in that case a temporary
+ * file is created for the body, to be written as the response is stripped.
+ */
+static ngx_int_t ngx_http_no_newlines_store_lookup (ngx_http_request_t *r,
+                                                    ngx_http_no_newlines_ctx_t *ctx,
+                                                    ngx_path_t *store,
+                                                    ngx_http_no_newlines_key_t *key,
+                                                    ngx_str_t *path)
+{
+        u_char                    *p, digest[16];
+        ngx_buf_t                 *b;
+        ngx_str_t                  name;
+        ngx_md5_t                  md5;
+        ngx_temp_file_t           *tf;
+        ngx_open_file_info_t       of;
+        ngx_http_core_loc_conf_t  *clcf;
+
+        /* the path tells apart files with the same inode on different devices */
+        ngx_md5_init (&md5);
+        ngx_md5_update (&md5, path->data, path->len);
+        ngx_md5_update (&md5, key, sizeof(ngx_http_no_newlines_key_t));
+        ngx_md5_final (digest, &md5);
+
+        name.len = store->name.len + 1 + store->len + 2 * sizeof(digest);
+        name.data = ngx_pnalloc (r->pool, name.len + 1);
+        if (name.data == NULL) {
+                return NGX_ERROR;
+        }
+
+        ngx_memcpy (name.data, store->name.data, store->name.len);
+        p = name.data + store->name.len + 1 + store->len;
+        p = ngx_hex_dump (p, digest, sizeof(digest));
+        *p = '\0';
+
+        ngx_create_hashed_filename (store, name.data, name.len);
+
+        clcf = ngx_http_get_module_loc_conf (r, ngx_http_core_module);
+
+        ngx_memzero (&of, sizeof(ngx_open_file_info_t));
+
+        of.read_ahead = clcf->read_ahead;
+        of.directio = clcf->directio;
+        of.valid = clcf->open_file_cache_valid;
+        of.min_uses = clcf->open_file_cache_min_uses;
+        of.errors = clcf->open_file_cache_errors;
+        of.events = clcf->open_file_cache_events;
+
+        if (ngx_open_cached_file (clcf->open_file_cache, &name, &of, r->pool) == NGX_OK
+            && of.is_file) {
+                b = ngx_calloc_buf (r->pool);
+                if (b == NULL) {
+                        return NGX_ERROR;
+                }
+
+                b->file = ngx_pcalloc (r->pool, sizeof(ngx_file_t));
+                if (b->file == NULL) {
+                        return NGX_ERROR;
+                }
+
+                b->file_pos = 0;
+                b->file_last = of.size;
+                b->in_file = b->file_last ? 1 : 0;
+
+                b->file->fd = of.fd;
+                b->file->name = name;
+                b->file->log = r->connection->log;
+                b->file->directio = of.is_directio;
+
+                ctx->stored = b;
+
+                return NGX_OK;
+        }
+
+        if (of.err != NGX_ENOENT && of.err != NGX_ENOTDIR) {
+                if (of.err) {
+                        ngx_log_error (NGX_LOG_CRIT, r->connection->log, of.err,
+                                       "%s \"%s\" failed", of.failed, name.data);
+                }
+
+                return NGX_DECLINED;
+        }
+
+        tf = ngx_pcalloc (r->pool, sizeof(ngx_temp_file_t));
+        if (tf == NULL) {
+                return NGX_ERROR;
+        }
+
+        tf->file.fd = NGX_INVALID_FILE;
+        tf->file.log = r->connection->log;
+        tf->path = store;
+        tf->pool = r->pool;
+        tf->persistent = 1;
+        tf->clean = 1;  /* removed with the request unless it is completed */
+        tf->access = NGX_FILE_OWNER_ACCESS;
+
+        if (ngx_create_temp_file (&tf->file, tf->path, tf->pool,
+                                  tf->persistent, tf->clean, tf->access) != NGX_OK) {
+                return NGX_DECLINED;
+        }
+
+        ctx->temp = tf;
+        ctx->store_name = name;
+
+        return NGX_DECLINED;
+}
+
+
+/* Tells whether a stored body must be read into memory to be sent */
+static ngx_uint_t ngx_http_no_newlines_store_in_memory (ngx_http_request_t *r,
+                                                        ngx_buf_t *file)
+{
+        if (r->main_filter_need_in_memory || r->filter_need_in_memory
+            || !r->connection->sendfile || file->file->directio) {
+                return 1;
+        }
+
+#if (NGX_SSL)
+        if (r->connection->ssl) {
+                return 1;
+        }
+#endif
+
+        return 0;
+}
+
+
+/*
+ * Sends a stored body read into output buffers of our own, as many and as
+ * large as no_newlines_buffers allows, each read as soon as one is free.
+ * Returns NGX_AGAIN if all of them are in use before the body is done with.
+ */
+static ngx_int_t ngx_http_no_newlines_store_send (ngx_http_request_t *r,
+                                                  ngx_http_no_newlines_ctx_t *ctx)
+{
+        ngx_int_t     rc;
+        ngx_buf_t    *b, *file;
+        ngx_chain_t  *cl;
+
+        file = ctx->stored;
+
+        for ( ;; ) {
+                ctx->out = NULL;
+                ctx->last_out = &ctx->out;
+
+                while (file->file_pos < file->file_last) {
+                        rc = ngx_http_no_newlines_get_buf (r, ctx);
+
+                        if (rc == NGX_ERROR) {
+                                return NGX_ERROR;
+                        }
+
+                        if (rc == NGX_AGAIN) {
+                                break;
+                        }
+
+                        b = ctx->buf;
+                        ctx->buf = NULL;
+
+                        if (ngx_http_no_newlines_store_read (r, file, b) != NGX_OK) {
+                                return NGX_ERROR;
+                        }
+
+                        if (file->file_pos == file->file_last) {
+                                b->last_buf = file->last_buf;
+                                b->last_in_chain = file->last_in_chain;
+                        }
+
+                        cl = ngx_alloc_chain_link (r->pool);
+                        if (cl == NULL) {
+                                return NGX_ERROR;
+                        }
+
+                        cl->buf = b;
+                        cl->next = NULL;
+
+                        *ctx->last_out = cl;
+                        ctx->last_out = &cl->next;
+                }
+
+                rc = ngx_http_next_body_filter (r, ctx->out);
+
+                ngx_chain_update_chains (r->pool, &ctx->free, &ctx->busy, &ctx->out,
+                                         (ngx_buf_tag_t) &ngx_http_no_newlines_module);
+
+                if (rc == NGX_ERROR || file->file_pos == file->file_last) {
+                        return rc;
+                }
+
+                if (ctx->free == NULL) {
+                        /* as for stripping, whoever holds the buffers */
+                        /* brings the writer back */
+                        return NGX_AGAIN;
+                }
+        }
+}
+
+
+/* Reads as much of a stored body as fits into b, from where it was left */
+static ngx_int_t ngx_http_no_newlines_store_read (ngx_http_request_t *r, ngx_buf_t *file,
+                                                  ngx_buf_t *b)
+{
+        size_t   size;
+        ssize_t  n;
+
+        size = (size_t) ngx_min ((off_t) (b->end - b->last), file->file_last - file->file_pos);
+
+        /* the buffer is not aligned as directio would need it */
+        if (file->file->directio
+            && ngx_directio_off (file->file->fd) == NGX_FILE_ERROR) {
+                ngx_log_error (NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                               ngx_directio_off_n " \"%s\" failed",
+                               file->file->name.data);
+                return NGX_ERROR;
+        }
+
+        n = ngx_read_file (file->file, b->last, size, file->file_pos);
+
+        if (file->file->directio
+            && ngx_directio_on (file->file->fd) == NGX_FILE_ERROR) {
+                ngx_log_error (NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                               ngx_directio_on_n " \"%s\" failed",
+                               file->file->name.data);
+        }
+
+        if (n == NGX_ERROR) {
+                return NGX_ERROR;
+        }
+
+        if ((size_t) n != size) {
+                ngx_log_error (NGX_LOG_CRIT, r->connection->log, 0,
+                               ngx_read_file_n " read only %z of %uz from \"%s\"",
+                               n, size, file->file->name.data);
+                return NGX_ERROR;
+        }
+
+        b->last += n;
+        file->file_pos += n;
+
+        return NGX_OK;
+}
+
+
+/* Writes the output in b to the body being stored */
+static void ngx_http_no_newlines_store_append (ngx_http_no_newlines_ctx_t *ctx,
+                                               ngx_buf_t *b)
+{
+        if (!ngx_buf_in_memory (b) || b->pos == b->last) {
+                return;
+        }
+
+        if (ngx_write_file (&ctx->temp->file, b->pos, b->last - b->pos,
+                            ctx->temp->file.offset) == NGX_ERROR) {
+                ctx->temp = NULL;
+        }
+}
+
+
+/* Moves the complete body into place for the requests that follow */
+static void ngx_http_no_newlines_store_commit (ngx_http_request_t *r,
+                                               ngx_http_no_newlines_ctx_t *ctx)
+{
+        ngx_ext_rename_file_t ext;
+
+        ext.access = NGX_FILE_OWNER_ACCESS;
+        ext.path_access = NGX_FILE_OWNER_ACCESS;
+        ext.time = -1;
+        ext.create_path = 1;
+        ext.delete_file = 1;
+        ext.fd = ctx->temp->file.fd;
+        ext.log = r->connection->log;
+
+        (void) ngx_ext_rename_file (&ctx->temp->file.name, &ctx->store_name, &ext);
+
+        ctx->temp = NULL;
 }
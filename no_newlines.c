@@ -0,0 +1,3087 @@
+/*
+ * The stripping engines: a table-driven automaton that drops newlines and
+ * extra whitespace outside of the <!--SC_OFF--> and <!--SC_ON--> markers,
+ * a tokenizer that does the same knowing tags from text, for options
+ * such as elements kept as they are, a JSON one that drops all whitespace
+ * outside of strings, and CSS and JavaScript ones that drop comments and
+ * the whitespace between tokens.  SIMD kernels skip over the text that
+ * needs no stripping.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "no_newlines.h"
+
+#if ((defined __x86_64__ || defined __i386__) && defined __GNUC__)
+#define NO_NEWLINES_X86  1
+#include <immintrin.h>
+#endif
+
+#define SC_OFF  NO_NEWLINES_SC_OFF
+#define SC_ON   NO_NEWLINES_SC_ON
+#define SC_OFF_LEN  (sizeof(SC_OFF)-1)
+#define SC_ON_LEN   (sizeof(SC_ON)-1)
+
+/* Declarations */
+
+typedef unsigned char *(*no_newlines_skip_pt) (unsigned char *p, unsigned char *last);
+
+typedef struct {
+        const char           *name;
+        no_newlines_skip_pt   skip_plain;
+        no_newlines_skip_pt   skip_pre;
+        no_newlines_skip_pt   skip_text;
+        no_newlines_skip_pt   skip_json;
+        no_newlines_skip_pt   skip_string;
+        int                 (*supported) (void);
+} no_newlines_kernel_t;
+
+/*
+ * States of the stripping automaton.  The "_space" states hold back a
+ * single space until the next byte tells whether it starts a run of
+ * spaces; the "raw" states copy the byte that follows a marker as is;
+ * dfa_off and dfa_on are followed by one state per matched byte of SC_OFF
+ * and SC_ON, during which the bytes of the candidate marker are held back.
+ */
+typedef enum {
+        dfa_text = 0,      /* compressing, at the start of a token */
+        dfa_text_space,
+        dfa_eat,           /* inside a run of whitespace */
+        dfa_eat_space,
+        dfa_tag_end,       /* dropping whitespace after '>' */
+        dfa_tag_end_space,
+        dfa_raw_text,      /* after SC_ON */
+        dfa_pre,           /* not compressing */
+        dfa_raw_pre,       /* after SC_OFF */
+        dfa_off,
+        dfa_on = dfa_off + SC_OFF_LEN - 1,
+        dfa_states = dfa_on + SC_ON_LEN - 1
+} no_newlines_dfa_state_e;
+
+/* Byte classes; the letters of the markers get classes of their own */
+typedef enum {
+        class_other = 0,
+        class_ws,          /* '\n', '\r' and '\t' */
+        class_space,
+        class_lt,
+        class_gt,
+        class_marker,
+        class_max = 16
+} no_newlines_class_e;
+
+/*
+ * Actions of a transition.  The common ones are flags that the loop applies
+ * without branching; anything in action_rare is handled out of line, and
+ * the "retry" actions feed the current byte again to the next state.
+ */
+#define action_emit          0x01
+#define action_hold          0x02
+#define action_match         0x04
+#define action_space         0x08
+#define action_space_retry   0x10
+#define action_spaces_retry  0x20
+#define action_flush_retry   0x40
+#define action_rare          (action_match | action_space | action_space_retry \
+                              | action_spaces_retry | action_flush_retry)
+
+typedef struct {
+        unsigned char next;
+        unsigned char action;
+} no_newlines_trans_t;
+
+/*
+ * States of the HTML tokenizer.  A '<' is held back, along with what
+ * follows it for as long as that may be a marker; whitespace is held back
+ * in flags until the next byte tells whether it is written, or past a
+ * '<' until what it starts is known.  In a preserved element, "closing"
+ * counts the bytes of "</name" seen, in a comment dropped, the '-' just
+ * seen, and after an end tag that may be left out, which one it is.
+ */
+typedef enum {
+        html_text = 0,     /* compressing */
+        html_lt,           /* after a '<' */
+        html_name,         /* in the name of a tag */
+        html_tag,          /* in a tag, past its name */
+        html_attr,         /* in the name of an attribute */
+        html_named,        /* after it and whitespace */
+        html_eq,           /* after its '=' */
+        html_value,        /* in an unquoted value */
+        html_dq,           /* in a "value" */
+        html_sq,           /* in a 'value' */
+        html_list_start,   /* at the start of a quoted list of words */
+        html_list,         /* in it */
+        html_omit,         /* after an end tag that may be left out */
+        html_omit_name,    /* in the name of the tag after it */
+        html_element,      /* in a preserved element */
+        html_pre,          /* between markers */
+        html_pre_lt,       /* after a '<' between markers */
+        html_comment       /* in a comment that is dropped */
+} no_newlines_html_state_e;
+
+#define html_ws        0x01
+#define html_run       0x02  /* the whitespace is more than a single space */
+#define html_gt        0x04  /* the last byte written was a '>' */
+#define html_close     0x08  /* the tag is a closing one */
+#define html_spaced    0x10  /* a space is owed in the tag */
+#define html_unquoted  0x20  /* it follows an unquoted value */
+#define html_block     0x40  /* the tag, or the one written last, is block-level */
+#define html_held      0x80  /* the tag is held back with the whitespace before */
+                             /* it, or the attribute value with its '=' */
+
+/* What a state of the matcher has matched, and for markers, of which pair */
+#define match_off      1
+#define match_on       2
+#define match_keep     3  /* the start of a comment that is kept */
+
+#define match_marker(kind, pair)  ((kind) | (pair) << 2)
+#define match_kind(matched)       ((matched) & 3)
+#define match_pair(matched)       ((matched) >> 2)
+
+#define html_comment_start  "<!--"
+
+#define html_blank(c)  ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t' || (c) == '\f')
+#define html_letter(c) (((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z')
+#define html_lower(c)  (((c) >= 'A' && (c) <= 'Z') ? (c) | 0x20 : (c))
+
+/* Whether whitespace held back up to a '<' is written, as a single space */
+#define html_space_kept(flags)                                                         \
+        (((flags) & (html_ws | html_run)) == html_ws                                    \
+         && ((flags) & (html_gt | html_block)) != (html_gt | html_block))
+
+/* States of the JSON engine */
+typedef enum {
+        json_value = 0,    /* outside of strings */
+        json_string,
+        json_escape        /* after a backslash in a string */
+} no_newlines_json_state_e;
+
+/*
+ * States of the CSS engine; each escape state follows the state it
+ * escapes from.  Whitespace, a ';' and a '/' that may start a comment are
+ * held back in flags until the next byte that counts tells whether they
+ * are written, and flags also counts the letters of a "url" just written.
+ */
+typedef enum {
+        css_text = 0,
+        css_escape,        /* after a backslash outside of strings */
+        css_dq,            /* in a "string" */
+        css_dq_escape,
+        css_sq,            /* in a 'string' */
+        css_sq_escape,
+        css_url,           /* in an unquoted url(), with no whitespace kept */
+        css_url_escape,
+        css_comment,
+        css_comment_star
+} no_newlines_css_state_e;
+
+#define css_ws         0x01
+#define css_semi       0x02
+#define css_slash      0x04
+#define css_url_shift  4
+#define css_url_mask   0x30
+
+/*
+ * States of the JavaScript engine; each escape state follows the state it
+ * escapes from.  Whitespace, whether it had a line end, and a '/' that
+ * may start a comment, a regular expression or a division are held back
+ * in flags.  Should templates nest deeper, or hold more braces, than the
+ * state has room for, the rest of the text is copied as it is.
+ */
+typedef enum {
+        js_code = 0,
+        js_dq,             /* in a "string" */
+        js_dq_escape,
+        js_sq,             /* in a 'string' */
+        js_sq_escape,
+        js_template,       /* in a `template` */
+        js_template_escape,
+        js_template_dollar,
+        js_regex,
+        js_regex_escape,
+        js_regex_class,    /* in a [class] of a regular expression */
+        js_regex_class_escape,
+        js_line_comment,
+        js_comment,
+        js_comment_star,
+        js_raw
+} no_newlines_js_state_e;
+
+#define js_ws          0x01
+#define js_nl          0x02
+#define js_slash       0x04
+#define js_regex_end   0x08  /* the '/' written last ended a regular expression */
+#define js_head        0x10  /* the ')' written last closed the head of an if, for,
+                                while or with */
+#define js_dot         0x20  /* a '.' after a line end, held back until what follows
+                                tells whether it starts a number */
+#define js_operand     0x40  /* the '+' or '-' written last followed an operand */
+#define js_postfix     0x80  /* the "++" or "--" written last followed an operand */
+
+#define js_ident(c)  (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z')           \
+                      || ((c) >= '0' && (c) <= '9') || (c) == '_' || (c) == '$'          \
+                      || (c) == '\\' || (c) == '#' || (c) >= 0x80)
+#define js_space(c)  ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t'             \
+                      || (c) == '\v' || (c) == '\f')
+
+static void no_newlines_dfa_marker (const char *marker, size_t len,
+                                    unsigned int first,
+                                    unsigned int base,
+                                    unsigned int matched);
+static unsigned char *no_newlines_feed_html (no_newlines_t *nl, unsigned char *in,
+                                             size_t len, unsigned char *out);
+static int no_newlines_conf_pattern (no_newlines_conf_t *conf, const unsigned char *pattern,
+                                     size_t len, unsigned int matched);
+static unsigned char *no_newlines_feed_markup (no_newlines_t *nl, unsigned char *in,
+                                               size_t len, unsigned char *out);
+static unsigned char *no_newlines_value (no_newlines_t *nl, unsigned char *writer,
+                                         unsigned int *flags, unsigned int quote);
+static unsigned int no_newlines_element (no_newlines_t *nl);
+static int no_newlines_block (const unsigned char *name, size_t len);
+static int no_newlines_boolean (const unsigned char *name, size_t len);
+static unsigned int no_newlines_omissible (const unsigned char *name, size_t len);
+static int no_newlines_omitted (unsigned int omissible, no_newlines_t *nl,
+                                unsigned int flags);
+static int no_newlines_listed (const char *list, const unsigned char *name, size_t len);
+static unsigned char *no_newlines_feed_json (no_newlines_t *nl, unsigned char *in,
+                                             size_t len, unsigned char *out);
+static unsigned char *no_newlines_feed_css (no_newlines_t *nl, unsigned char *in,
+                                            size_t len, unsigned char *out);
+static unsigned char *no_newlines_css_put (unsigned char *writer, unsigned int c,
+                                           unsigned int *flags, unsigned int *prev);
+static unsigned char *no_newlines_feed_js (no_newlines_t *nl, unsigned char *in,
+                                           size_t len, unsigned char *out);
+static unsigned char *no_newlines_js_put (no_newlines_t *nl, unsigned char *writer,
+                                          unsigned int c);
+static int no_newlines_js_regex (no_newlines_t *nl);
+static int no_newlines_js_head (no_newlines_t *nl);
+static unsigned char *no_newlines_skip_plain_scalar (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_pre_scalar (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_text_scalar (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_json_scalar (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_string_scalar (unsigned char *p, unsigned char *last);
+static int no_newlines_scalar_supported (void);
+#if (NO_NEWLINES_X86)
+static unsigned char *no_newlines_skip_plain_sse2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_pre_sse2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_text_sse2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_json_sse2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_string_sse2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_plain_avx2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_pre_avx2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_text_avx2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_json_avx2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_string_avx2 (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_plain_avx512bw (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_pre_avx512bw (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_text_avx512bw (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_json_avx512bw (unsigned char *p, unsigned char *last);
+static unsigned char *no_newlines_skip_string_avx512bw (unsigned char *p, unsigned char *last);
+static int no_newlines_sse2_supported (void);
+static int no_newlines_avx2_supported (void);
+static int no_newlines_avx512bw_supported (void);
+#endif
+
+
+/* The scan kernels, indexed by no_newlines_kernel_e */
+static no_newlines_kernel_t  no_newlines_kernel_table[] = {
+        { "auto", NULL, NULL, NULL, NULL, NULL, NULL },
+        { "scalar",
+          no_newlines_skip_plain_scalar,
+          no_newlines_skip_pre_scalar,
+          no_newlines_skip_text_scalar,
+          no_newlines_skip_json_scalar,
+          no_newlines_skip_string_scalar,
+          no_newlines_scalar_supported },
+#if (NO_NEWLINES_X86)
+        { "sse2",
+          no_newlines_skip_plain_sse2,
+          no_newlines_skip_pre_sse2,
+          no_newlines_skip_text_sse2,
+          no_newlines_skip_json_sse2,
+          no_newlines_skip_string_sse2,
+          no_newlines_sse2_supported },
+        { "avx2",
+          no_newlines_skip_plain_avx2,
+          no_newlines_skip_pre_avx2,
+          no_newlines_skip_text_avx2,
+          no_newlines_skip_json_avx2,
+          no_newlines_skip_string_avx2,
+          no_newlines_avx2_supported },
+        { "avx512bw",
+          no_newlines_skip_plain_avx512bw,
+          no_newlines_skip_pre_avx512bw,
+          no_newlines_skip_text_avx512bw,
+          no_newlines_skip_json_avx512bw,
+          no_newlines_skip_string_avx512bw,
+          no_newlines_avx512bw_supported },
+#endif
+        { NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+
+/* Byte classes and transitions, built by no_newlines_init_tables */
+static unsigned char        no_newlines_class[256];
+static no_newlines_trans_t  no_newlines_dfa[dfa_states][class_max];
+
+
+/* Bound by no_newlines_use_kernel */
+static no_newlines_skip_pt  no_newlines_skip_plain = no_newlines_skip_plain_scalar;
+static no_newlines_skip_pt  no_newlines_skip_pre = no_newlines_skip_pre_scalar;
+static no_newlines_skip_pt  no_newlines_skip_text = no_newlines_skip_text_scalar;
+static no_newlines_skip_pt  no_newlines_skip_json = no_newlines_skip_json_scalar;
+static no_newlines_skip_pt  no_newlines_skip_string = no_newlines_skip_string_scalar;
+
+
+/* Function definitions start here */
+
+void no_newlines_init_tables (void)
+{
+        unsigned int          c, k, state;
+        no_newlines_trans_t  *t;
+
+        memset (no_newlines_class, 0, sizeof(no_newlines_class));
+
+        no_newlines_class['\n'] = class_ws;
+        no_newlines_class['\r'] = class_ws;
+        no_newlines_class['\t'] = class_ws;
+        no_newlines_class[' '] = class_space;
+        no_newlines_class['<'] = class_lt;
+        no_newlines_class['>'] = class_gt;
+
+        /* markers are matched case-insensitively */
+        k = class_marker;
+        for (c = 0; c < SC_OFF_LEN + SC_ON_LEN; c++) {
+                state = (c < SC_OFF_LEN) ? (unsigned char) SC_OFF[c]
+                                         : (unsigned char) SC_ON[c - SC_OFF_LEN];
+                state = tolower (state);
+
+                if (no_newlines_class[state] == class_other) {
+                        no_newlines_class[state] = (unsigned char) k;
+                        if (state >= 'a' && state <= 'z') {
+                                no_newlines_class[state - 0x20] = (unsigned char) k;
+                        }
+                        k++;
+                }
+        }
+
+        for (state = 0; state < dfa_states; state++) {
+                t = no_newlines_dfa[state];
+
+                for (c = 0; c < class_max; c++) {
+                        switch (state) {
+
+                        case dfa_text:
+                                t[c].next = dfa_text;
+                                t[c].action = action_emit;
+                                break;
+
+                        case dfa_text_space:
+                        case dfa_tag_end_space:
+                                /* the held space was a single one */
+                                t[c].next = dfa_text;
+                                t[c].action = action_space_retry;
+                                break;
+
+                        case dfa_eat:
+                                /* the first byte after a run gets a space */
+                                /* in front of it, unless it is a '<' */
+                                t[c].next = dfa_text;
+                                t[c].action = action_space;
+                                break;
+
+                        case dfa_eat_space:
+                                /* the held space ends the run, and is kept */
+                                /* along with the one standing for the run */
+                                t[c].next = dfa_text;
+                                t[c].action = action_spaces_retry;
+                                break;
+
+                        case dfa_tag_end:
+                                t[c].next = dfa_text;
+                                t[c].action = action_emit;
+                                break;
+
+                        case dfa_raw_text:
+                                t[c].next = dfa_text;
+                                t[c].action = action_emit;
+                                break;
+
+                        case dfa_pre:
+                                t[c].next = dfa_pre;
+                                t[c].action = action_emit;
+                                break;
+
+                        case dfa_raw_pre:
+                                t[c].next = dfa_pre;
+                                t[c].action = action_emit;
+                                break;
+
+                        default:
+                                /* a mismatch in a candidate marker */
+                                t[c].next = (state < dfa_on) ? dfa_text : dfa_pre;
+                                t[c].action = action_flush_retry;
+                                break;
+                        }
+                }
+        }
+
+        /* whitespace */
+        t = no_newlines_dfa[dfa_text];
+        t[class_ws].next = dfa_eat;
+        t[class_ws].action = 0;
+        t[class_space].next = dfa_text_space;
+        t[class_space].action = 0;
+        t[class_gt].next = dfa_tag_end;
+        t[class_gt].action = action_emit;
+
+        t = no_newlines_dfa[dfa_text_space];
+        t[class_space].next = dfa_eat_space;
+        t[class_space].action = 0;
+
+        t = no_newlines_dfa[dfa_eat];
+        t[class_ws].next = dfa_eat;
+        t[class_ws].action = 0;
+        t[class_space].next = dfa_eat_space;
+        t[class_space].action = 0;
+
+        t = no_newlines_dfa[dfa_eat_space];
+        t[class_space].next = dfa_eat_space;
+        t[class_space].action = 0;
+
+        t = no_newlines_dfa[dfa_tag_end];
+        t[class_ws].next = dfa_tag_end;
+        t[class_ws].action = 0;
+        t[class_space].next = dfa_tag_end_space;
+        t[class_space].action = 0;
+
+        t = no_newlines_dfa[dfa_tag_end_space];
+        t[class_space].next = dfa_tag_end_space;
+        t[class_space].action = 0;
+
+        /* markers: SC_OFF is looked for wherever a token starts while */
+        /* compressing, SC_ON anywhere while not */
+        no_newlines_dfa_marker (SC_OFF, SC_OFF_LEN, dfa_text,
+                                dfa_off, dfa_raw_pre);
+        no_newlines_dfa_marker (SC_OFF, SC_OFF_LEN, dfa_eat,
+                                dfa_off, dfa_raw_pre);
+        no_newlines_dfa_marker (SC_OFF, SC_OFF_LEN, dfa_tag_end,
+                                dfa_off, dfa_raw_pre);
+        no_newlines_dfa_marker (SC_ON, SC_ON_LEN, dfa_pre,
+                                dfa_on, dfa_raw_text);
+}
+
+
+static void no_newlines_dfa_marker (const char *marker, size_t len,
+                                    unsigned int first,
+                                    unsigned int base,
+                                    unsigned int matched)
+{
+        size_t                k;
+        no_newlines_trans_t  *t;
+
+        t = &no_newlines_dfa[first][no_newlines_class[(unsigned char) marker[0]]];
+        t->next = (unsigned char) base;
+        t->action = action_hold;
+
+        for (k = 1; k < len; k++) {
+                t = &no_newlines_dfa[base + k - 1]
+                                    [no_newlines_class[(unsigned char) marker[k]]];
+
+                if (k == len - 1) {
+                        t->next = (unsigned char) matched;
+                        t->action = action_match;
+                } else {
+                        t->next = (unsigned char) (base + k);
+                        t->action = action_hold;
+                }
+        }
+}
+
+
+const char *no_newlines_kernel_name (no_newlines_kernel_e kernel)
+{
+        if ((size_t) kernel >= sizeof(no_newlines_kernel_table)
+                               / sizeof(no_newlines_kernel_t) - 1) {
+                return NULL;
+        }
+
+        return no_newlines_kernel_table[kernel].name;
+}
+
+
+int no_newlines_kernel_supported (no_newlines_kernel_e kernel)
+{
+        if (kernel == no_newlines_kernel_auto) {
+                return 1;
+        }
+
+        if (no_newlines_kernel_name (kernel) == NULL) {
+                return 0;
+        }
+
+        return no_newlines_kernel_table[kernel].supported ();
+}
+
+
+no_newlines_kernel_e no_newlines_use_kernel (no_newlines_kernel_e kernel)
+{
+        unsigned int i;
+
+        if (kernel == no_newlines_kernel_auto || !no_newlines_kernel_supported (kernel)) {
+                /* the table is ordered from the slowest kernel to the fastest */
+                for (i = no_newlines_kernel_scalar; no_newlines_kernel_table[i].supported; i++) {
+                        if (no_newlines_kernel_table[i].supported ()) {
+                                kernel = i;
+                        }
+                }
+        }
+
+        no_newlines_skip_plain = no_newlines_kernel_table[kernel].skip_plain;
+        no_newlines_skip_pre = no_newlines_kernel_table[kernel].skip_pre;
+        no_newlines_skip_text = no_newlines_kernel_table[kernel].skip_text;
+        no_newlines_skip_json = no_newlines_kernel_table[kernel].skip_json;
+        no_newlines_skip_string = no_newlines_kernel_table[kernel].skip_string;
+
+        return kernel;
+}
+
+
+void no_newlines_conf_init (no_newlines_conf_t *conf)
+{
+        memset (conf, 0, sizeof(no_newlines_conf_t));
+
+        conf->level = 1;
+
+        /* state 0 is where a mismatch leads, state 1 is before the '<' */
+        conf->nstates = 2;
+        conf->nclasses = 1;
+
+        no_newlines_conf_pattern (conf, (unsigned char *) SC_OFF, SC_OFF_LEN, match_off);
+        no_newlines_conf_pattern (conf, (unsigned char *) SC_ON, SC_ON_LEN, match_on);
+}
+
+
+int no_newlines_conf_markers (no_newlines_conf_t *conf, const unsigned char *off,
+                              size_t off_len, const unsigned char *on, size_t on_len)
+{
+        unsigned int  i, pair = conf->nmarkers;
+
+        /* a marker is looked for where a '<' does not start a tag */
+        if (off_len < 2 || off[0] != '<' || html_letter (off[1]) || off[1] == '/'
+            || on_len < 2 || on[0] != '<' || html_letter (on[1]) || on[1] == '/'
+            || pair == NO_NEWLINES_MARKERS_MAX) {
+                return -1;
+        }
+
+        for (i = 0; i < conf->nstates; i++) {
+                if (conf->matched[i] == match_keep) {
+                        return -1;
+                }
+        }
+
+        if (pair == 0) {
+                /* the matcher starts over without SC_OFF and SC_ON */
+                memset (conf->classes, 0, sizeof(conf->classes));
+                memset (conf->next, 0, sizeof(conf->next));
+                memset (conf->matched, 0, sizeof(conf->matched));
+                conf->nstates = 2;
+                conf->nclasses = 1;
+        }
+
+        if (no_newlines_conf_pattern (conf, off, off_len, match_marker (match_off, pair)) != 0
+            || no_newlines_conf_pattern (conf, on, on_len, match_marker (match_on, pair)) != 0) {
+                return -1;
+        }
+
+        conf->nmarkers = pair + 1;
+
+        return 0;
+}
+
+
+int no_newlines_conf_element (no_newlines_conf_t *conf, const unsigned char *name,
+                              size_t len)
+{
+        size_t i;
+
+        if (len == 0 || len > NO_NEWLINES_NAME_MAX
+            || conf->nelements == NO_NEWLINES_ELEMENTS_MAX) {
+                return -1;
+        }
+
+        for (i = 0; i < len; i++) {
+                conf->elements[conf->nelements][i] = (unsigned char) tolower (name[i]);
+        }
+
+        conf->lengths[conf->nelements++] = (unsigned char) len;
+
+        return 0;
+}
+
+
+int no_newlines_conf_level (no_newlines_conf_t *conf, unsigned int level)
+{
+        if (level < 1 || level > 3) {
+                return -1;
+        }
+
+        conf->level = level;
+
+        return 0;
+}
+
+
+void no_newlines_conf_blocks (no_newlines_conf_t *conf)
+{
+        conf->blocks = 1;
+}
+
+
+void no_newlines_conf_keep_markers (no_newlines_conf_t *conf)
+{
+        conf->markers_kept = 1;
+}
+
+
+void no_newlines_conf_comments (no_newlines_conf_t *conf)
+{
+        conf->comments = 1;
+
+        /* <!--[if IE]>...<![endif]--> and <!--[if !IE]><!-->...<!--<![endif]--> */
+        no_newlines_conf_comment (conf, (unsigned char *) "[if", 3);
+        no_newlines_conf_comment (conf, (unsigned char *) "<![endif]", 9);
+}
+
+
+int no_newlines_conf_comment (no_newlines_conf_t *conf, const unsigned char *prefix,
+                              size_t len)
+{
+        unsigned char  pattern[NO_NEWLINES_PATTERN_MAX];
+        size_t         n = sizeof(html_comment_start) - 1;
+
+        if (len == 0 || len > NO_NEWLINES_PATTERN_MAX - n) {
+                return -1;
+        }
+
+        memcpy (pattern, html_comment_start, n);
+        memcpy (pattern + n, prefix, len);
+
+        return no_newlines_conf_pattern (conf, pattern, n + len, match_keep);
+}
+
+
+/*
+ * Adds a pattern to the matcher, a trie over byte classes in which upper
+ * and lower case letters share a class.  Patterns are only looked for
+ * from a '<', so no failure links are needed: a byte that leads nowhere
+ * ends the match, and is looked at again from the root, which is where a
+ * failure link would lead as patterns start with a '<'; one inside a
+ * pattern, as in "<!--<![endif]", is inside a comment, where no pattern
+ * can start.  A byte costs a lookup however many patterns there are.  As
+ * a match ends where a pattern does, no pattern may start with another.
+ * Returns -1 if one does, or the matcher is out of room.
+ */
+static int no_newlines_conf_pattern (no_newlines_conf_t *conf, const unsigned char *pattern,
+                                     size_t len, unsigned int matched)
+{
+        size_t        i;
+        unsigned int  c, k, state;
+
+        if (len > NO_NEWLINES_PATTERN_MAX) {
+                return -1;
+        }
+
+        for (state = 1, i = 0; i < len; i++) {
+                if (conf->matched[state]) {
+                        return -1;
+                }
+
+                c = tolower (pattern[i]);
+                k = conf->classes[c];
+
+                if (k == 0) {
+                        if (conf->nclasses == NO_NEWLINES_MATCH_CLASSES) {
+                                return -1;
+                        }
+
+                        k = conf->nclasses++;
+                        conf->classes[c] = (unsigned char) k;
+                        conf->classes[toupper (c)] = (unsigned char) k;
+                }
+
+                if (conf->next[state][k] == 0) {
+                        if (conf->nstates == NO_NEWLINES_MATCH_STATES) {
+                                return -1;
+                        }
+
+                        conf->next[state][k] = (unsigned char) conf->nstates++;
+                }
+
+                state = conf->next[state][k];
+        }
+
+        if (conf->matched[state]) {
+                return -1;
+        }
+
+        for (k = 0; k < conf->nclasses; k++) {
+                if (conf->next[state][k]) {
+                        return -1;
+                }
+        }
+
+        conf->matched[state] = (unsigned char) matched;
+
+        return 0;
+}
+
+
+void no_newlines_init (no_newlines_t *nl, no_newlines_mode_e mode,
+                       const no_newlines_conf_t *conf)
+{
+        /* XML is stripped as HTML is, between tags and outside markers */
+        nl->conf = (mode == no_newlines_mode_html || mode == no_newlines_mode_xml)
+                   ? conf : NULL;
+        nl->mode = (unsigned char) mode;
+        nl->state = (mode == no_newlines_mode_json) ? json_value
+                    : (mode == no_newlines_mode_css) ? css_text
+                    : (mode == no_newlines_mode_js) ? js_code
+                    : nl->conf ? html_text : dfa_text;
+        nl->prev = 0;
+        nl->flags = 0;
+        nl->nhold = 0;
+        nl->match = 0;
+        nl->nword = 0;
+        nl->element = 0;
+        nl->closing = 0;
+        nl->marker = 0;
+        nl->depth = 0;
+        nl->parens = 0;
+}
+
+
+unsigned char *no_newlines_feed (no_newlines_t *nl, unsigned char *in, size_t len,
+                                 unsigned char *out)
+{
+        switch (nl->mode) {
+
+        case no_newlines_mode_json:
+                return no_newlines_feed_json (nl, in, len, out);
+
+        case no_newlines_mode_css:
+                return no_newlines_feed_css (nl, in, len, out);
+
+        case no_newlines_mode_js:
+                return no_newlines_feed_js (nl, in, len, out);
+
+        default:
+                return nl->conf ? no_newlines_feed_markup (nl, in, len, out)
+                                : no_newlines_feed_html (nl, in, len, out);
+        }
+}
+
+
+/*
+ * Runs the span through the automaton.  The state, including a candidate
+ * marker held back at the end, is kept in nl, so the result does not
+ * depend on how the text is split.  Writing over the input is safe while
+ * nothing is pending at the start: bytes are then only ever dropped, or
+ * held back and written later in place of bytes that were.
+ */
+static unsigned char *no_newlines_feed_html (no_newlines_t *nl, unsigned char *in,
+                                             size_t len, unsigned char *out)
+{
+        unsigned char        *reader, *last, *writer, *t;
+        unsigned int          state, nhold;
+        no_newlines_trans_t   tr;
+
+        reader = in;
+        last = in + len;
+        writer = out;
+
+        state = nl->state;
+        nhold = nl->nhold;
+
+        while (reader < last) {
+
+                if (state == dfa_text || state == dfa_pre) {
+                        /* runs of bytes that are copied through unchanged */
+                        /* are moved at once */
+                        t = (state == dfa_text)
+                            ? no_newlines_skip_plain (reader, last)
+                            : no_newlines_skip_pre (reader, last);
+                        if (t != reader) {
+                                if (writer != reader) {
+                                        memmove (writer, reader, t - reader);
+                                }
+                                writer += t - reader;
+                                reader = t;
+                        }
+                }
+
+                tr = no_newlines_dfa[state][no_newlines_class[*reader]];
+
+                if (tr.action & action_rare) {
+                        switch (tr.action) {
+
+                        case action_match:
+                                nhold = 0;
+                                break;
+
+                        case action_space:
+                                if (*reader != '<') {
+                                        *writer++ = ' ';
+                                }
+                                state = tr.next;
+                                continue;
+
+                        case action_space_retry:
+                                *writer++ = ' ';
+                                state = tr.next;
+                                continue;
+
+                        case action_spaces_retry:
+                                *writer++ = ' ';
+                                *writer++ = ' ';
+                                state = tr.next;
+                                continue;
+
+                        default: /* action_flush_retry */
+                                memcpy (writer, nl->hold, nhold);
+                                writer += nhold;
+                                nhold = 0;
+                                state = tr.next;
+                                continue;
+                        }
+                }
+
+                nl->hold[nhold] = *reader;
+                *writer = *reader;
+                writer += tr.action & action_emit;
+                nhold += (tr.action & action_hold) >> 1;
+                state = tr.next;
+                reader++;
+        }
+
+        nl->state = (unsigned char) state;
+        nl->nhold = (unsigned char) nhold;
+
+        return writer;
+}
+
+
+/*
+ * Elements laid out as blocks, or not rendered at all, around whose tags
+ * whitespace makes no difference, indexed by the length of their names
+ */
+static const char  *no_newlines_blocks[] = {
+        "",
+        "p",
+        "dd dl dt h1 h2 h3 h4 h5 h6 hr li ol td th tr ul",
+        "col dir div nav pre",
+        "area base body form head html link main menu meta",
+        "aside frame param table tbody tfoot thead title track",
+        "center dialog figure footer header hgroup legend option source",
+        "address article caption details section summary",
+        "colgroup fieldset frameset noframes optgroup",
+        "",
+        "blockquote figcaption"
+};
+
+
+/* Attributes that are true by being there, indexed by the length of their names */
+static const char  *no_newlines_booleans[] = {
+        "", "", "", "",
+        "loop open",
+        "async defer inert ismap muted",
+        "hidden",
+        "checked default",
+        "autoplay controls disabled multiple nomodule readonly required reversed selected",
+        "autofocus itemscope",
+        "novalidate",
+        "playsinline",
+        "", "",
+        "formnovalidate",
+        "allowfullscreen"
+};
+
+/*
+ * Attributes whose values are lists of words separated by whitespace, which
+ * can be collapsed
+ */
+static const char  *no_newlines_lists = "accesskey aria-controls aria-describedby "
+        "aria-flowto aria-labelledby aria-owns class headers itemprop itemref "
+        "itemtype ping rel rev sandbox";
+
+
+/*
+ * Elements whose end tag may be left out, the start tags before which it
+ * may, and the end tags before which it may, or NULL for all of them but
+ * those of custom elements.  That of p may only before the end tag of an
+ * element which the parser closes it at, as it ignores any other while p
+ * is open.
+ */
+static const char  *no_newlines_omissibles[][3] = {
+        { "li", "li", NULL },
+        { "dt", "dt dd", "" },
+        { "dd", "dd dt", NULL },
+        { "p", "address article aside blockquote details dialog div dl fieldset "
+               "figcaption figure footer form h1 h2 h3 h4 h5 h6 header hgroup hr "
+               "main menu nav ol p pre search section table ul",
+          "address article aside blockquote body button caption center dd details "
+          "dialog dir div dl dt fieldset figcaption figure footer form h1 h2 h3 h4 "
+          "h5 h6 header hgroup html li listing main menu nav object ol pre search "
+          "section summary td template th ul" },
+        { "tr", "tr", NULL },
+        { "td", "td th", NULL },
+        { "th", "td th", NULL },
+        { "option", "option optgroup hr", NULL }
+};
+
+
+/*
+ * Strips HTML knowing tags from text.  In text, whitespace is collapsed
+ * into a single space, or into nothing after a '>' or before a '<' unless
+ * it is a single space; in tags, it is collapsed into a single space, or
+ * into nothing around a '=', before the end of the tag, and before a '/'
+ * but after an unquoted value.  Quoted values are kept as they are, but
+ * for the lists of words of HTML attributes such as class, in which
+ * whitespace is collapsed into a single space, or into nothing at either
+ * end.  The content of a preserved element is copied as it is up to its
+ * closing tag, and so is what is between markers, which are dropped
+ * unless they are kept.  Writing over the input is safe as for the
+ * automaton.
+ */
+static unsigned char *no_newlines_feed_markup (no_newlines_t *nl, unsigned char *in,
+                                               size_t len, unsigned char *out)
+{
+        unsigned char             *reader, *last, *writer, *t, *p, c;
+        unsigned int               state, flags, k, n;
+        const no_newlines_conf_t  *conf = nl->conf;
+
+        reader = in;
+        last = in + len;
+        writer = out;
+
+        state = nl->state;
+        flags = nl->flags;
+
+        while (reader < last) {
+
+                if (state == html_comment && nl->closing == 0) {
+                        /* up to a '-', a comment is dropped at once */
+                        t = memchr (reader, '-', last - reader);
+                        reader = t ? t : last;
+
+                        if (reader == last) {
+                                break;
+                        }
+                }
+
+                /* runs of bytes that are copied through unchanged */
+                /* are moved at once */
+                t = reader;
+
+                if (state == html_text && !(flags & html_ws)) {
+                        /* not even a single space is copied after a */
+                        /* block-level tag */
+                        t = ((flags & (html_gt | html_block)) == (html_gt | html_block)
+                             && *reader == ' ') ? reader : no_newlines_skip_text (reader, last);
+
+                        /* a space before a '<' is held back, as a */
+                        /* comment after it may be dropped */
+                        if (t != last && *t == '<' && t != reader && t[-1] == ' ') {
+                                t--;
+                        }
+
+                } else if (state == html_value) {
+                        /* which ends at any space */
+                        t = no_newlines_skip_text (reader, last);
+                        p = memchr (reader, ' ', t - reader);
+                        t = p ? p : t;
+
+                } else if ((state == html_element && nl->closing == 0) || state == html_pre) {
+                        t = memchr (reader, '<', last - reader);
+                        t = t ? t : last;
+
+                } else if ((state == html_dq || state == html_sq) && !(flags & html_held)) {
+                        t = memchr (reader, (state == html_dq) ? '"' : '\'', last - reader);
+                        t = t ? t : last;
+                }
+
+                if (t != reader) {
+                        if (writer != reader) {
+                                memmove (writer, reader, t - reader);
+                        }
+                        writer += t - reader;
+                        reader = t;
+                        flags &= ~html_gt;
+
+                        if (reader == last) {
+                                break;
+                        }
+                }
+
+                c = *reader++;
+
+again:
+
+                switch (state) {
+
+                case html_text:
+                        break;
+
+                case html_lt:
+                        if (nl->nhold == 1 && (html_letter (c) || c == '/')) {
+                                nl->nword = 0;
+                                state = html_name;
+
+                                if (nl->mode == no_newlines_mode_html
+                                    && ((conf->blocks && html_space_kept (flags))
+                                        || (conf->level >= 3 && c == '/'))) {
+                                        /* whether the whitespace before goes, */
+                                        /* or the tag, depends on its name */
+                                        if (!html_space_kept (flags)) {
+                                                flags &= ~(html_ws | html_run);
+                                        }
+
+                                        flags &= ~(html_gt | html_close | html_spaced
+                                                   | html_unquoted | html_block);
+                                        flags |= html_held;
+
+                                        if (c == '/') {
+                                                nl->hold[nl->nhold++] = c;
+                                                flags |= html_close;
+                                                continue;
+                                        }
+                                        goto again;
+                                }
+
+                                /* a tag, before which whitespace is as before a '<' */
+                                if (html_space_kept (flags)) {
+                                        *writer++ = ' ';
+                                }
+
+                                *writer++ = '<';
+                                nl->nhold = 0;
+                                flags &= ~(html_ws | html_run | html_gt | html_close | html_spaced
+                                           | html_unquoted | html_block);
+
+                                if (c == '/') {
+                                        *writer++ = c;
+                                        flags |= html_close;
+                                        continue;
+                                }
+                                goto again;
+                        }
+
+                        k = conf->next[nl->match][conf->classes[c]];
+                        n = conf->matched[k];
+
+                        if (match_kind (n) == match_on && conf->comments) {
+                                /* a stray on marker is a comment, */
+                                /* unless markers are kept */
+                                if (conf->markers_kept) {
+                                        if (html_space_kept (flags)) {
+                                                *writer++ = ' ';
+                                        }
+
+                                        flags &= ~(html_ws | html_run | html_gt);
+                                        memcpy (writer, nl->hold, nl->nhold);
+                                        writer += nl->nhold;
+                                        *writer++ = c;
+                                }
+
+                                nl->nhold = 0;
+                                state = html_text;
+                                continue;
+                        }
+
+                        if (conf->comments && (k == 0 || nl->nhold == NO_NEWLINES_PATTERN_MAX)
+                            && nl->nhold >= sizeof(html_comment_start) - 1
+                            && memcmp (nl->hold, html_comment_start,
+                                       sizeof(html_comment_start) - 1) == 0) {
+                                /* a comment, dropped up to its "-->" */
+                                /* along with the whitespace after it, */
+                                /* as if it were not there */
+                                for (n = 0; n < 2 && nl->hold[nl->nhold - 1 - n] == '-'; n++) {
+                                        /* void */
+                                }
+
+                                nl->closing = (unsigned char) n;
+                                nl->nhold = 0;
+                                state = html_comment;
+                                goto again;
+                        }
+
+                        if (match_kind (n) != match_off && n != match_keep && k
+                            && nl->nhold < NO_NEWLINES_PATTERN_MAX) {
+                                nl->hold[nl->nhold++] = c;
+                                nl->match = (unsigned char) k;
+                                continue;
+                        }
+
+                        if (html_space_kept (flags)) {
+                                *writer++ = ' ';
+                        }
+
+                        flags &= ~(html_ws | html_run | html_gt);
+
+                        if (match_kind (n) == match_off) {
+                                /* the marker is dropped, unless kept */
+                                if (conf->markers_kept) {
+                                        memcpy (writer, nl->hold, nl->nhold);
+                                        writer += nl->nhold;
+                                        *writer++ = c;
+                                }
+
+                                nl->nhold = 0;
+                                nl->marker = (unsigned char) match_pair (n);
+                                state = html_pre;
+                                continue;
+                        }
+
+                        /* not a marker, or a comment that is kept, */
+                        /* and flows on as text */
+                        memcpy (writer, nl->hold, nl->nhold);
+                        writer += nl->nhold;
+                        nl->nhold = 0;
+                        state = html_text;
+                        goto again;
+
+                case html_pre_lt:
+                        k = conf->next[nl->match][conf->classes[c]];
+
+                        if (conf->matched[k] == match_marker (match_on, nl->marker)) {
+                                /* the marker is dropped, unless kept */
+                                if (conf->markers_kept) {
+                                        memcpy (writer, nl->hold, nl->nhold);
+                                        writer += nl->nhold;
+                                        *writer++ = c;
+                                }
+
+                                nl->nhold = 0;
+                                state = html_text;
+                                continue;
+                        }
+
+                        if (k == 0 || nl->nhold == NO_NEWLINES_PATTERN_MAX) {
+                                memcpy (writer, nl->hold, nl->nhold);
+                                writer += nl->nhold;
+                                nl->nhold = 0;
+                                state = html_pre;
+                                goto again;
+                        }
+
+                        nl->hold[nl->nhold++] = c;
+                        nl->match = (unsigned char) k;
+                        continue;
+
+                case html_name:
+                        if (flags & html_held) {
+                                if (!html_blank (c) && c != '>' && c != '/'
+                                    && nl->nhold < NO_NEWLINES_PATTERN_MAX) {
+                                        nl->hold[nl->nhold++] = c;
+
+                                        if (nl->nword < NO_NEWLINES_NAME_MAX) {
+                                                nl->word[nl->nword++] = html_lower (c);
+                                        } else {
+                                                nl->nword = NO_NEWLINES_NAME_MAX + 1;
+                                        }
+                                        continue;
+                                }
+
+                                n = (html_blank (c) || c == '>' || c == '/');
+
+                                /* the whitespace is dropped before a */
+                                /* block-level tag, and kept before others */
+                                if ((flags & html_ws)
+                                    && !(n && conf->blocks
+                                         && no_newlines_block (nl->word, nl->nword))) {
+                                        *writer++ = ' ';
+                                }
+
+                                k = (n && c == '>' && (flags & html_close) && conf->level >= 3)
+                                    ? no_newlines_omissible (nl->word, nl->nword) : 0;
+
+                                if (k) {
+                                        /* an end tag that may be left out, held */
+                                        /* back until the tag after it tells */
+                                        nl->hold[nl->nhold++] = c;
+                                        nl->closing = (unsigned char) k;
+                                        flags &= ~(html_ws | html_run | html_close | html_held);
+                                        flags |= html_gt;
+
+                                        if (conf->blocks
+                                            && no_newlines_block (nl->word, nl->nword)) {
+                                                flags |= html_block;
+                                        }
+
+                                        state = html_omit;
+                                        continue;
+                                }
+
+                                memcpy (writer, nl->hold, nl->nhold);
+                                writer += nl->nhold;
+                                nl->nhold = 0;
+                                flags &= ~(html_ws | html_run | html_held);
+                        }
+
+                        while (!html_blank (c) && c != '>' && c != '/') {
+                                *writer++ = c;
+
+                                if (nl->nword < NO_NEWLINES_NAME_MAX) {
+                                        nl->word[nl->nword++] = html_lower (c);
+                                } else {
+                                        /* longer than any element preserved */
+                                        nl->nword = NO_NEWLINES_NAME_MAX + 1;
+                                }
+
+                                if (reader == last) {
+                                        break;
+                                }
+                                c = *reader++;
+                        }
+
+                        if (reader == last && !html_blank (c) && c != '>' && c != '/') {
+                                continue;
+                        }
+
+                        if (!(flags & html_close)) {
+                                nl->element = (unsigned char) no_newlines_element (nl);
+                        }
+
+                        if (conf->blocks && nl->mode == no_newlines_mode_html
+                            && no_newlines_block (nl->word, nl->nword)) {
+                                flags |= html_block;
+                        }
+
+                        state = html_tag;
+                        goto again;
+
+                case html_tag:
+                        if (html_blank (c)) {
+                                flags |= html_spaced;
+                                continue;
+                        }
+
+                        if (flags & html_spaced) {
+                                /* an unquoted value would take in a '/' */
+                                if (c != '>' && (c != '/' || (flags & html_unquoted))) {
+                                        *writer++ = ' ';
+                                }
+                                flags &= ~html_spaced;
+                        }
+
+                        flags &= ~html_unquoted;
+
+                        if (c == '>') {
+                                *writer++ = c;
+                                flags |= html_gt;
+                                nl->closing = 0;
+                                state = nl->element ? html_element : html_text;
+                                continue;
+                        }
+
+                        if (c == '/') {
+                                *writer++ = c;
+                                continue;
+                        }
+
+                        if (c == '=') {
+                                if (conf->level >= 2 && nl->mode == no_newlines_mode_html) {
+                                        /* held back along with the value */
+                                        nl->hold[0] = c;
+                                        nl->nhold = 1;
+                                        flags |= html_held;
+                                } else {
+                                        *writer++ = c;
+                                }
+
+                                state = html_eq;
+                                continue;
+                        }
+
+                        nl->nword = 0;
+                        state = html_attr;
+                        goto again;
+
+                case html_attr:
+                        while (!html_blank (c) && c != '>' && c != '/' && c != '=') {
+                                *writer++ = c;
+
+                                if (nl->nword < NO_NEWLINES_NAME_MAX) {
+                                        nl->word[nl->nword++] = html_lower (c);
+                                } else {
+                                        nl->nword = NO_NEWLINES_NAME_MAX + 1;
+                                }
+
+                                if (reader == last) {
+                                        break;
+                                }
+                                c = *reader++;
+                        }
+
+                        if (reader == last && !html_blank (c) && c != '>' && c != '/' && c != '=') {
+                                continue;
+                        }
+
+                        if (html_blank (c)) {
+                                flags |= html_spaced;
+                                state = html_named;
+                                continue;
+                        }
+
+                        state = html_tag;
+                        goto again;
+
+                case html_named:
+                        if (html_blank (c)) {
+                                continue;
+                        }
+
+                        if (c == '=') {
+                                /* a = b as a=b */
+                                flags &= ~html_spaced;
+                        }
+
+                        state = html_tag;
+                        goto again;
+
+                case html_eq:
+                        if (html_blank (c)) {
+                                continue;
+                        }
+
+                        if (c == '"' || c == '\'') {
+                                if (nl->mode == no_newlines_mode_html
+                                    && no_newlines_listed (no_newlines_lists, nl->word, nl->nword))
+                                {
+                                        nl->prev = c;
+                                        state = html_list_start;
+
+                                } else {
+                                        state = (c == '"') ? html_dq : html_sq;
+                                }
+
+                                if (flags & html_held) {
+                                        nl->hold[nl->nhold++] = c;
+                                } else {
+                                        *writer++ = c;
+                                }
+                                continue;
+                        }
+
+                        if (flags & html_held) {
+                                /* only quoted values are held back */
+                                memcpy (writer, nl->hold, nl->nhold);
+                                writer += nl->nhold;
+                                nl->nhold = 0;
+                                flags &= ~html_held;
+                        }
+
+                        state = (c == '>') ? html_tag : html_value;
+                        goto again;
+
+                case html_value:
+                        if (html_blank (c)) {
+                                flags |= html_spaced | html_unquoted;
+                                state = html_tag;
+                                continue;
+                        }
+
+                        if (c == '>') {
+                                state = html_tag;
+                                goto again;
+                        }
+
+                        *writer++ = c;
+                        continue;
+
+                case html_dq:
+                case html_sq:
+                        n = (state == html_dq) ? '"' : '\'';
+
+                        if (flags & html_held) {
+                                if (c == n) {
+                                        writer = no_newlines_value (nl, writer, &flags, n);
+                                        state = html_tag;
+                                        continue;
+                                }
+
+                                if (nl->nhold < NO_NEWLINES_PATTERN_MAX) {
+                                        nl->hold[nl->nhold++] = c;
+                                        continue;
+                                }
+
+                                /* too long to be worth holding back */
+                                memcpy (writer, nl->hold, nl->nhold);
+                                writer += nl->nhold;
+                                nl->nhold = 0;
+                                flags &= ~html_held;
+                        }
+
+                        *writer++ = c;
+                        if (c == n) {
+                                state = html_tag;
+                        }
+                        continue;
+
+                case html_list_start:
+                        if (html_blank (c)) {
+                                continue;
+                        }
+
+                        state = html_list;
+                        goto again;
+
+                case html_list:
+                        if (c == nl->prev) {
+                                /* whitespace at the end is dropped */
+                                flags &= ~html_spaced;
+
+                                if (flags & html_held) {
+                                        writer = no_newlines_value (nl, writer, &flags, c);
+                                } else {
+                                        *writer++ = c;
+                                }
+
+                                state = html_tag;
+                                continue;
+                        }
+
+                        if (html_blank (c)) {
+                                flags |= html_spaced;
+                                continue;
+                        }
+
+                        n = (flags & html_spaced) ? 2 : 1;
+                        flags &= ~html_spaced;
+
+                        if ((flags & html_held) && nl->nhold + n > NO_NEWLINES_PATTERN_MAX) {
+                                /* too long to be worth holding back */
+                                memcpy (writer, nl->hold, nl->nhold);
+                                writer += nl->nhold;
+                                nl->nhold = 0;
+                                flags &= ~html_held;
+                        }
+
+                        if (flags & html_held) {
+                                if (n == 2) {
+                                        nl->hold[nl->nhold++] = ' ';
+                                }
+                                nl->hold[nl->nhold++] = c;
+
+                        } else {
+                                if (n == 2) {
+                                        *writer++ = ' ';
+                                }
+                                *writer++ = c;
+                        }
+                        continue;
+
+                case html_omit:
+                        if (html_blank (c)) {
+                                flags |= (c == ' ' && !(flags & html_ws)) ? html_ws
+                                                                         : html_ws | html_run;
+                                continue;
+                        }
+
+                        if (c == '<' && nl->nhold < NO_NEWLINES_PATTERN_MAX) {
+                                nl->hold[nl->nhold++] = c;
+                                nl->nword = 0;
+                                state = html_omit_name;
+                                continue;
+                        }
+
+                        /* text after it, which it ends */
+                        memcpy (writer, nl->hold, nl->nhold);
+                        writer += nl->nhold;
+                        nl->nhold = 0;
+                        state = html_text;
+                        goto again;
+
+                case html_omit_name:
+                        /* the end tag held back is up to the first '>' */
+                        t = memchr (nl->hold, '>', nl->nhold);
+                        n = t - nl->hold + 1;
+
+                        if (c == '/' && nl->nhold == n + 1) {
+                                nl->hold[nl->nhold++] = c;
+                                flags |= html_close;
+                                continue;
+                        }
+
+                        if (html_letter (c)
+                            || (nl->nword && !html_blank (c) && c != '>' && c != '/')) {
+                                if (nl->nhold < NO_NEWLINES_PATTERN_MAX) {
+                                        nl->hold[nl->nhold++] = c;
+
+                                        if (nl->nword < NO_NEWLINES_NAME_MAX) {
+                                                nl->word[nl->nword++] = html_lower (c);
+                                        } else {
+                                                nl->nword = NO_NEWLINES_NAME_MAX + 1;
+                                        }
+                                        continue;
+                                }
+
+                                k = 0;
+
+                        } else {
+                                k = nl->nword && no_newlines_omitted (nl->closing, nl, flags);
+                        }
+
+                        /* the end tag is written or left out, and what */
+                        /* follows goes on as if held back by itself */
+                        if (k) {
+                                flags &= ~(html_ws | html_run);
+
+                        } else {
+                                memcpy (writer, nl->hold, n);
+                                writer += n;
+
+                                if (!html_space_kept (flags)) {
+                                        flags &= ~(html_ws | html_run);
+                                }
+                        }
+
+                        nl->nhold = (unsigned char) (nl->nhold - n);
+                        memmove (nl->hold, nl->hold + n, nl->nhold);
+                        flags &= ~(html_gt | html_block);
+
+                        if (nl->nhold == 1 && !html_letter (c) && c != '/') {
+                                /* not a tag */
+                                nl->match = conf->next[1][conf->classes['<']];
+                                state = html_lt;
+                                goto again;
+                        }
+
+                        flags |= html_held;
+                        state = html_name;
+                        goto again;
+
+                case html_element:
+                        n = nl->closing;
+                        k = nl->element - 1;
+
+                        if (n == 2u + conf->lengths[k]) {
+                                if (html_blank (c) || c == '>' || c == '/') {
+                                        /* the closing tag */
+                                        nl->element = 0;
+                                        flags = (flags & ~(html_spaced | html_block)) | html_close;
+
+                                        if (conf->blocks
+                                            && no_newlines_block (conf->elements[k],
+                                                                  conf->lengths[k])) {
+                                                flags |= html_block;
+                                        }
+
+                                        state = html_tag;
+                                        goto again;
+                                }
+                                n = 0;
+                        }
+
+                        *writer++ = c;
+                        nl->closing = (unsigned char) (
+                                (n == 1 && c == '/') ? 2
+                                : (n >= 2 && html_lower (c) == conf->elements[k][n - 2]) ? n + 1
+                                : (c == '<'));
+                        continue;
+
+                case html_comment:
+                        if (c == '>' && nl->closing == 2) {
+                                nl->closing = 0;
+                                state = html_text;
+                                continue;
+                        }
+
+                        nl->closing = (unsigned char) ((c != '-') ? 0
+                                                       : (nl->closing < 2) ? nl->closing + 1 : 2);
+                        continue;
+
+                default: /* html_pre */
+                        if (c == '<') {
+                                nl->hold[0] = c;
+                                nl->nhold = 1;
+                                nl->match = conf->next[1][conf->classes[c]];
+                                state = html_pre_lt;
+                                continue;
+                        }
+
+                        *writer++ = c;
+                        continue;
+                }
+
+                /* compressing */
+
+                if (flags & html_ws) {
+                        if (html_blank (c)) {
+                                flags |= html_run;
+                                continue;
+                        }
+
+                        if (c != '<') {
+                                if (!(flags & html_gt) || !(flags & (html_run | html_block))) {
+                                        *writer++ = ' ';
+                                }
+
+                                flags &= ~(html_ws | html_run);
+                        }
+                }
+
+                switch (c) {
+
+                case '<':
+                        nl->hold[0] = c;
+                        nl->nhold = 1;
+                        nl->match = conf->next[1][conf->classes[c]];
+                        state = html_lt;
+                        continue;
+
+                case '>':
+                        *writer++ = c;
+                        flags = (flags & ~html_block) | html_gt;
+                        continue;
+
+                case ' ':
+                case '\n':
+                case '\r':
+                case '\t':
+                case '\f':
+                        flags |= (c == ' ') ? html_ws : html_ws | html_run;
+                        continue;
+                }
+
+                *writer++ = c;
+                flags &= ~html_gt;
+        }
+
+        nl->state = (unsigned char) state;
+        nl->flags = (unsigned char) flags;
+
+        return writer;
+}
+
+
+/*
+ * Writes out an attribute value held back with its '=' and opening quote,
+ * once its closing quote is seen: as nothing if it is that of a boolean
+ * attribute, without quotes if it can do without, or else as it is.  A
+ * space is then owed before whatever follows in the tag.
+ */
+static unsigned char *no_newlines_value (no_newlines_t *nl, unsigned char *writer,
+                                         unsigned int *flags, unsigned int quote)
+{
+        unsigned char  *value = nl->hold + 2, c;
+        size_t          i, len = nl->nhold - 2;
+
+        for (i = 0; i < len && i < nl->nword && html_lower (value[i]) == nl->word[i]; i++) {
+                /* void */
+        }
+
+        if (no_newlines_boolean (nl->word, nl->nword)
+            && (len == 0 || (i == len && len == nl->nword))) {
+                /* checked="checked", or checked="", as checked */
+                nl->nhold = 0;
+                *flags = (*flags & ~html_held) | html_spaced;
+                return writer;
+        }
+
+        for (i = 0; i < len; i++) {
+                c = value[i];
+
+                if (html_blank (c) || c == '"' || c == '\'' || c == '=' || c == '<' || c == '>'
+                    || c == '`') {
+                        break;
+                }
+        }
+
+        if (len && i == len) {
+                *writer++ = '=';
+                memcpy (writer, value, len);
+                writer += len;
+                *flags |= html_spaced | html_unquoted;
+
+        } else {
+                memcpy (writer, nl->hold, nl->nhold);
+                writer += nl->nhold;
+                *writer++ = (unsigned char) quote;
+        }
+
+        nl->nhold = 0;
+        *flags &= ~html_held;
+
+        return writer;
+}
+
+
+/* Whether a lowercased name is that of a block-level element */
+static int no_newlines_block (const unsigned char *name, size_t len)
+{
+        const char  *b;
+
+        if (len >= sizeof(no_newlines_blocks) / sizeof(char *)) {
+                return 0;
+        }
+
+        for (b = no_newlines_blocks[len]; *b; b += len + (b[len] == ' ')) {
+                if (memcmp (b, name, len) == 0) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+
+/* Whether a lowercased name is that of a boolean attribute */
+static int no_newlines_boolean (const unsigned char *name, size_t len)
+{
+        const char  *b;
+
+        if (len >= sizeof(no_newlines_booleans) / sizeof(char *)) {
+                return 0;
+        }
+
+        for (b = no_newlines_booleans[len]; *b; b += len + (b[len] == ' ')) {
+                if (memcmp (b, name, len) == 0) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+
+/* Which element, from 1, an end tag that may be left out is of, or 0 */
+static unsigned int no_newlines_omissible (const unsigned char *name, size_t len)
+{
+        unsigned int  i;
+
+        for (i = 0; i < sizeof(no_newlines_omissibles) / sizeof(no_newlines_omissibles[0]); i++) {
+                if (strlen (no_newlines_omissibles[i][0]) == len
+                    && memcmp (no_newlines_omissibles[i][0], name, len) == 0) {
+                        return i + 1;
+                }
+        }
+
+        return 0;
+}
+
+
+/* Whether the end tag of an element may be left out before the tag just named */
+static int no_newlines_omitted (unsigned int omissible, no_newlines_t *nl,
+                                unsigned int flags)
+{
+        const char  **rule = no_newlines_omissibles[omissible - 1];
+
+        if (flags & html_close) {
+                /* the parser ignores the end tag of a custom element */
+                /* while li, dd or a cell is still open */
+                if (nl->nword > NO_NEWLINES_NAME_MAX
+                    || memchr (nl->word, '-', nl->nword) != NULL) {
+                        return 0;
+                }
+
+                return rule[2] == NULL || no_newlines_listed (rule[2], nl->word, nl->nword);
+        }
+
+        return no_newlines_listed (rule[1], nl->word, nl->nword);
+}
+
+
+/* Whether a lowercased name is one of those in a list separated by spaces */
+static int no_newlines_listed (const char *list, const unsigned char *name, size_t len)
+{
+        size_t  n;
+
+        while (*list) {
+                n = strcspn (list, " ");
+
+                if (n == len && memcmp (list, name, len) == 0) {
+                        return 1;
+                }
+
+                list += n + (list[n] == ' ');
+        }
+
+        return 0;
+}
+
+
+/* Which preserved element the tag just named opens, from 1, or 0 */
+static unsigned int no_newlines_element (no_newlines_t *nl)
+{
+        unsigned int               i;
+        const no_newlines_conf_t  *conf = nl->conf;
+
+        if (nl->mode != no_newlines_mode_html) {
+                return 0;
+        }
+
+        for (i = 0; i < conf->nelements; i++) {
+                if (conf->lengths[i] == nl->nword
+                    && memcmp (conf->elements[i], nl->word, nl->nword) == 0) {
+                        return i + 1;
+                }
+        }
+
+        return 0;
+}
+
+
+/*
+ * Drops whitespace outside of strings.  Nothing is ever held back, as
+ * whether a byte is dropped depends only on the bytes before it; the
+ * only state is whether the span starts in a string, or after a
+ * backslash in one.
+ */
+static unsigned char *no_newlines_feed_json (no_newlines_t *nl, unsigned char *in,
+                                             size_t len, unsigned char *out)
+{
+        unsigned char  *reader, *last, *writer, *t;
+        unsigned int    state;
+
+        reader = in;
+        last = in + len;
+        writer = out;
+
+        state = nl->state;
+
+        while (reader < last) {
+
+                if (state == json_escape) {
+                        *writer++ = *reader++;
+                        state = json_string;
+                        continue;
+                }
+
+                t = (state == json_string)
+                    ? no_newlines_skip_string (reader, last)
+                    : no_newlines_skip_json (reader, last);
+                if (t != reader) {
+                        if (writer != reader) {
+                                memmove (writer, reader, t - reader);
+                        }
+                        writer += t - reader;
+                        reader = t;
+
+                        if (reader == last) {
+                                break;
+                        }
+                }
+
+                switch (*reader) {
+
+                case '"':
+                        state = (state == json_string) ? json_value : json_string;
+                        *writer++ = *reader++;
+                        break;
+
+                case '\\':
+                        state = json_escape;
+                        *writer++ = *reader++;
+                        break;
+
+                default:
+                        /* a run of whitespace */
+                        do {
+                                reader++;
+                        } while (reader < last
+                                 && (*reader == ' ' || *reader == '\n'
+                                     || *reader == '\r' || *reader == '\t'));
+                        break;
+                }
+        }
+
+        nl->state = (unsigned char) state;
+
+        return writer;
+}
+
+
+/*
+ * Drops comments, collapses whitespace into a single space, or into
+ * nothing next to "{", "}", ";", ":", "," and ">" and inside parentheses,
+ * and drops the ';' before a '}'.  Whitespace before a ':' is kept, since
+ * "a :hover" and "a:hover" are different selectors, and so is whitespace
+ * before a '(', since "and (" is not a function.  Strings are kept as they are, and so is what
+ * is in an unquoted url() but its whitespace.  A comment counts as
+ * whitespace, so that it never joins the tokens on either side.
+ */
+static unsigned char *no_newlines_feed_css (no_newlines_t *nl, unsigned char *in,
+                                            size_t len, unsigned char *out)
+{
+        unsigned char  *reader, *last, *writer, c;
+        unsigned int    state, flags, prev, url, lc;
+
+        reader = in;
+        last = in + len;
+        writer = out;
+
+        state = nl->state;
+        flags = nl->flags;
+        prev = nl->prev;
+
+        while (reader < last) {
+                c = *reader++;
+
+                switch (state) {
+
+                case css_text:
+                        break;
+
+                case css_escape:
+                        /* an escaped byte is part of an identifier, */
+                        /* whatever it is */
+                        *writer++ = c;
+                        prev = '\\';
+                        state = css_text;
+                        continue;
+
+                case css_dq:
+                case css_sq:
+                        *writer++ = c;
+                        if (c == '\\') {
+                                state++;
+                        } else if (c == ((state == css_dq) ? '"' : '\'')) {
+                                state = css_text;
+                        }
+                        continue;
+
+                case css_dq_escape:
+                case css_sq_escape:
+                case css_url_escape:
+                        *writer++ = c;
+                        state--;
+                        continue;
+
+                case css_url:
+                        if (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f') {
+                                continue;
+                        }
+
+                        *writer++ = c;
+                        prev = c;
+
+                        if (c == ')') {
+                                state = css_text;
+                        } else if (c == '"') {
+                                state = css_dq;
+                        } else if (c == '\'') {
+                                state = css_sq;
+                        } else if (c == '\\') {
+                                state = css_url_escape;
+                        }
+                        continue;
+
+                case css_comment:
+                        if (c == '*') {
+                                state = css_comment_star;
+                        }
+                        continue;
+
+                default: /* css_comment_star */
+                        if (c == '/') {
+                                state = css_text;
+                        } else if (c != '*') {
+                                state = css_comment;
+                        }
+                        continue;
+                }
+
+                if (flags & css_slash) {
+                        flags &= ~css_slash;
+
+                        if (c == '*') {
+                                flags |= css_ws;
+                                state = css_comment;
+                                continue;
+                        }
+
+                        writer = no_newlines_css_put (writer, '/', &flags, &prev);
+                }
+
+                switch (c) {
+
+                case ' ':
+                case '\n':
+                case '\r':
+                case '\t':
+                case '\f':
+                        flags = (flags & ~css_url_mask) | css_ws;
+                        continue;
+
+                case '/':
+                        flags = (flags & ~css_url_mask) | css_slash;
+                        continue;
+
+                case ';':
+                        flags = (flags & ~css_ws) | css_semi;
+                        continue;
+                }
+
+                url = (flags & css_url_mask) >> css_url_shift;
+                writer = no_newlines_css_put (writer, c, &flags, &prev);
+
+                switch (c) {
+
+                case '"':
+                        state = css_dq;
+                        break;
+
+                case '\'':
+                        state = css_sq;
+                        break;
+
+                case '\\':
+                        state = css_escape;
+                        break;
+
+                case '(':
+                        if (url == 3) {
+                                state = css_url;
+                        }
+                        break;
+                }
+
+                lc = c | 0x20;
+                url = (url == 1 && lc == 'r') ? 2
+                      : (url == 2 && lc == 'l') ? 3
+                      : (lc == 'u');
+                flags = (flags & ~css_url_mask) | (url << css_url_shift);
+        }
+
+        nl->state = (unsigned char) state;
+        nl->flags = (unsigned char) flags;
+        nl->prev = (unsigned char) prev;
+
+        return writer;
+}
+
+
+/* Writes a byte that counts, after what was held back before it */
+static unsigned char *no_newlines_css_put (unsigned char *writer, unsigned int c,
+                                           unsigned int *flags, unsigned int *prev)
+{
+        if (*flags & css_semi) {
+                if (c != '}') {
+                        *writer++ = ';';
+                }
+
+        } else if ((*flags & css_ws) && *prev
+                   && !memchr ("{};:,(>", *prev, 7) && !memchr ("{};,)>", c, 6)) {
+                *writer++ = ' ';
+        }
+
+        *flags &= ~(css_ws | css_semi);
+        *writer++ = (unsigned char) c;
+        *prev = c;
+
+        return writer;
+}
+
+
+/*
+ * Drops comments and whitespace, but for a space between two tokens that
+ * would otherwise run together, and a line end wherever automatic
+ * semicolon insertion could depend on it: between a token that may end a
+ * statement and one that may start one.  Strings, templates and regular
+ * expressions are copied as they are; a '/' starts a regular expression
+ * where a division could not, after an operator, a keyword such as
+ * "return", or the head of an if, for, while or with.  A comment counts as
+ * whitespace, with a line end if it had one.
+ */
+static unsigned char *no_newlines_feed_js (no_newlines_t *nl, unsigned char *in,
+                                           size_t len, unsigned char *out)
+{
+        unsigned char  *reader, *last, *writer, c;
+        unsigned int    state;
+
+        reader = in;
+        last = in + len;
+        writer = out;
+
+        state = nl->state;
+
+        while (reader < last) {
+                c = *reader++;
+
+again:
+
+                switch (state) {
+
+                case js_code:
+                        break;
+
+                case js_dq:
+                case js_sq:
+                        *writer++ = c;
+                        if (c == '\\') {
+                                state++;
+                        } else if (c == ((state == js_dq) ? '"' : '\'')) {
+                                state = js_code;
+                        }
+                        continue;
+
+                case js_dq_escape:
+                case js_sq_escape:
+                case js_template_escape:
+                case js_regex_escape:
+                case js_regex_class_escape:
+                        *writer++ = c;
+                        state--;
+                        continue;
+
+                case js_template_dollar:
+                        if (c == '{') {
+                                *writer++ = c;
+
+                                if (nl->depth == sizeof(nl->braces)) {
+                                        state = js_raw;
+                                        continue;
+                                }
+
+                                nl->braces[nl->depth++] = 0;
+                                nl->prev = '{';
+                                nl->nword = 0;
+                                state = js_code;
+                                continue;
+                        }
+
+                        state = js_template;
+
+                        /* fall through */
+
+                case js_template:
+                        *writer++ = c;
+                        if (c == '\\') {
+                                state = js_template_escape;
+                        } else if (c == '$') {
+                                state = js_template_dollar;
+                        } else if (c == '`') {
+                                nl->prev = '`';
+                                nl->nword = 0;
+                                state = js_code;
+                        }
+                        continue;
+
+                case js_regex:
+                case js_regex_class:
+                        *writer++ = c;
+                        if (c == '\\') {
+                                state++;
+                        } else if (c == '[') {
+                                state = js_regex_class;
+                        } else if (c == ']' && state == js_regex_class) {
+                                state = js_regex;
+                        } else if (c == '/' && state == js_regex) {
+                                nl->prev = '/';
+                                nl->flags |= js_regex_end;
+                                state = js_code;
+                        } else if (c == '\n' || c == '\r') {
+                                /* not a regular expression after all */
+                                state = js_code;
+                        }
+                        continue;
+
+                case js_line_comment:
+                        if (c == '\n' || c == '\r') {
+                                nl->flags |= js_nl;
+                                state = js_code;
+                        }
+                        continue;
+
+                case js_comment:
+                        if (c == '*') {
+                                state = js_comment_star;
+                        } else if (c == '\n' || c == '\r') {
+                                nl->flags |= js_nl;
+                        }
+                        continue;
+
+                case js_comment_star:
+                        if (c == '/') {
+                                state = js_code;
+                        } else if (c != '*') {
+                                state = js_comment;
+                                goto again;
+                        }
+                        continue;
+
+                default: /* js_raw */
+                        *writer++ = c;
+                        continue;
+                }
+
+                if (nl->flags & js_dot) {
+                        /* the line end is kept before a number such as .5 */
+                        if (c < '0' || c > '9') {
+                                nl->flags &= ~js_dot;
+                        }
+
+                        writer = no_newlines_js_put (nl, writer, '.');
+                }
+
+                if (nl->flags & js_slash) {
+                        nl->flags &= ~js_slash;
+
+                        if (c == '/') {
+                                nl->flags |= js_ws;
+                                state = js_line_comment;
+                                continue;
+                        }
+
+                        if (c == '*') {
+                                nl->flags |= js_ws;
+                                state = js_comment;
+                                continue;
+                        }
+
+                        if (no_newlines_js_regex (nl)) {
+                                writer = no_newlines_js_put (nl, writer, '/');
+                                state = js_regex;
+                                goto again;
+                        }
+
+                        writer = no_newlines_js_put (nl, writer, '/');
+                }
+
+                if (js_space (c)) {
+                        nl->flags |= (c == '\n' || c == '\r') ? js_ws | js_nl : js_ws;
+                        continue;
+                }
+
+                if (c == '/') {
+                        nl->flags |= js_slash;
+                        continue;
+                }
+
+                if (c == '.' && (nl->flags & js_nl)) {
+                        nl->flags |= js_dot;
+                        continue;
+                }
+
+                if (c == '}' && nl->depth && nl->braces[nl->depth - 1] == 0) {
+                        /* the end of a ${} */
+                        writer = no_newlines_js_put (nl, writer, c);
+                        nl->depth--;
+                        state = js_template;
+                        continue;
+                }
+
+                writer = no_newlines_js_put (nl, writer, c);
+
+                switch (c) {
+
+                case '"':
+                        state = js_dq;
+                        break;
+
+                case '\'':
+                        state = js_sq;
+                        break;
+
+                case '`':
+                        state = js_template;
+                        break;
+
+                case '{':
+                        if (nl->depth && ++nl->braces[nl->depth - 1] == 0) {
+                                state = js_raw;
+                        }
+                        break;
+
+                case '}':
+                        if (nl->depth) {
+                                nl->braces[nl->depth - 1]--;
+                        }
+                        break;
+                }
+        }
+
+        nl->state = (unsigned char) state;
+
+        return writer;
+}
+
+
+/* Writes a byte that counts, after the whitespace held back before it */
+static unsigned char *no_newlines_js_put (no_newlines_t *nl, unsigned char *writer,
+                                          unsigned int c)
+{
+        unsigned int  prev = nl->prev, flags = nl->flags;
+
+        if ((nl->flags & (js_ws | js_nl)) && prev) {
+
+                if ((nl->flags & js_nl)
+                    && (js_ident (prev) || memchr (")]}'\"`+-/", prev, 9))
+                    && (js_ident (c) || memchr ("([{'\"`+-!~/@", c, 12)
+                        || (c == '.' && (nl->flags & js_dot)))) {
+                        *writer++ = '\n';
+
+                } else if ((js_ident (prev) && js_ident (c))
+                           || (prev == c && (c == '+' || c == '-'))
+                           || (prev == '/' && (c == '/' || ((nl->flags & js_regex_end)
+                                                             && js_ident (c))))
+                           || (prev >= '0' && prev <= '9' && c == '.')) {
+                        *writer++ = ' ';
+                }
+        }
+
+        nl->flags &= ~(js_ws | js_nl | js_regex_end | js_head | js_dot
+                       | js_operand | js_postfix);
+        *writer++ = (unsigned char) c;
+        nl->prev = (unsigned char) c;
+
+        if (c == '+' || c == '-') {
+                /* a "++" or "--" right after an operand, on its line, is */
+                /* a postfix one, after which a '/' is a division */
+                if (prev == c && (flags & js_operand) && !(flags & (js_ws | js_nl))) {
+                        nl->flags |= js_postfix;
+
+                } else if ((js_ident (prev) || prev == ')' || prev == ']')
+                           && !(flags & js_nl)) {
+                        nl->flags |= js_operand;
+                }
+        }
+
+        if (c == '(') {
+                if (nl->parens) {
+                        /* nested too deep to follow, the head is lost */
+                        nl->parens = (nl->parens < 255) ? nl->parens + 1 : 0;
+
+                } else if (no_newlines_js_head (nl)) {
+                        nl->parens = 1;
+                }
+
+        } else if (c == ')' && nl->parens && --nl->parens == 0) {
+                nl->flags |= js_head;
+        }
+
+        if (!js_ident (c)) {
+                nl->nword = 0;
+
+        } else if (nl->nword < sizeof(nl->word)) {
+                nl->word[nl->nword++] = (unsigned char) c;
+
+        } else {
+                /* longer than any keyword */
+                nl->nword = sizeof(nl->word) + 1;
+        }
+
+        return writer;
+}
+
+
+/* Whether a '/' after what was written starts a regular expression */
+static int no_newlines_js_regex (no_newlines_t *nl)
+{
+        size_t             len;
+        const char       **k;
+        static const char  *keywords[] = {
+                "return", "typeof", "instanceof", "in", "of", "new", "delete",
+                "void", "throw", "case", "do", "else", "yield", "await", NULL
+        };
+
+        if (nl->flags & js_postfix) {
+                return 0;
+        }
+
+        if (nl->prev == 0 || memchr ("(,=:[!&|?{};+-*%<>~^", nl->prev, 20)
+            || (nl->prev == ')' && (nl->flags & js_head))) {
+                return 1;
+        }
+
+        if (!js_ident (nl->prev) || nl->nword > sizeof(nl->word)) {
+                return 0;
+        }
+
+        for (k = keywords; *k; k++) {
+                len = strlen (*k);
+                if (len == nl->nword && memcmp (*k, nl->word, len) == 0) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+
+/* Whether the word written last starts a head in parentheses after it */
+static int no_newlines_js_head (no_newlines_t *nl)
+{
+        return (nl->nword == 2 && memcmp (nl->word, "if", 2) == 0)
+               || (nl->nword == 3 && memcmp (nl->word, "for", 3) == 0)
+               || (nl->nword == 4 && memcmp (nl->word, "with", 4) == 0)
+               || (nl->nword == 5 && memcmp (nl->word, "while", 5) == 0);
+}
+
+
+unsigned char *no_newlines_finish (no_newlines_t *nl, unsigned char *out)
+{
+        unsigned char *writer = out;
+        unsigned int   flags, prev;
+
+        if (nl->mode == no_newlines_mode_js) {
+                /* a comment left open, and whitespace at the end, are dropped */
+                if (nl->state == js_code && (nl->flags & js_slash)) {
+                        writer = no_newlines_js_put (nl, writer, '/');
+
+                } else if (nl->flags & js_dot) {
+                        nl->flags &= ~js_dot;
+                        writer = no_newlines_js_put (nl, writer, '.');
+                }
+
+                no_newlines_init (nl, nl->mode, nl->conf);
+                return writer;
+        }
+
+        if (nl->mode == no_newlines_mode_json) {
+                no_newlines_init (nl, nl->mode, nl->conf);
+                return writer;
+        }
+
+        if (nl->mode == no_newlines_mode_css) {
+                flags = nl->flags;
+                prev = nl->prev;
+
+                /* a comment left open, and whitespace at the end, are dropped */
+                if (nl->state == css_text && (flags & css_slash)) {
+                        writer = no_newlines_css_put (writer, '/', &flags, &prev);
+
+                } else if (flags & css_semi) {
+                        *writer++ = ';';
+                }
+
+                no_newlines_init (nl, nl->mode, nl->conf);
+                return writer;
+        }
+
+        if (nl->conf) {
+                /* a single space at the end is kept, as the automaton does, */
+                /* but for one after an end tag held back, which is dropped */
+                if (html_space_kept (nl->flags)
+                    && nl->state != html_omit && nl->state != html_omit_name) {
+                        *writer++ = ' ';
+                }
+
+                memcpy (writer, nl->hold, nl->nhold);
+                writer += nl->nhold;
+
+                no_newlines_init (nl, nl->mode, nl->conf);
+                return writer;
+        }
+
+        switch (nl->state) {
+
+        case dfa_text_space:
+        case dfa_tag_end_space:
+                *writer++ = ' ';
+                break;
+
+        case dfa_eat_space:
+                *writer++ = ' ';
+                *writer++ = ' ';
+                break;
+
+        default:
+                memcpy (writer, nl->hold, nl->nhold);
+                writer += nl->nhold;
+                break;
+        }
+
+        no_newlines_init (nl, nl->mode, nl->conf);
+
+        return writer;
+}
+
+
+size_t no_newlines_pending (no_newlines_t *nl)
+{
+        if (nl->mode == no_newlines_mode_json) {
+                return 0;
+        }
+
+        if (nl->mode == no_newlines_mode_css) {
+                return (nl->flags & css_ws) + ((nl->flags & css_semi) >> 1)
+                       + ((nl->flags & css_slash) >> 2);
+        }
+
+        if (nl->mode == no_newlines_mode_js) {
+                return ((nl->flags & (js_ws | js_nl)) ? 1 : 0) + ((nl->flags & js_slash) >> 2)
+                       + ((nl->flags & js_dot) >> 5);
+        }
+
+        if (nl->conf) {
+                return nl->nhold + (nl->flags & html_ws) + ((nl->flags & html_spaced) >> 4);
+        }
+
+        switch (nl->state) {
+
+        case dfa_text_space:
+        case dfa_tag_end_space:
+        case dfa_eat:
+                return 1;
+
+        case dfa_eat_space:
+                return 2;
+
+        default:
+                return nl->nhold;
+        }
+}
+
+
+int no_newlines_preserving (no_newlines_t *nl)
+{
+        if (nl->mode != no_newlines_mode_html && nl->mode != no_newlines_mode_xml) {
+                return 0;
+        }
+
+        if (nl->conf) {
+                return nl->state == html_pre || nl->state == html_pre_lt;
+        }
+
+        /* a candidate SC_ON does not end preserving until it is matched */
+        return nl->state == dfa_pre || nl->state == dfa_raw_pre || nl->state >= dfa_on;
+}
+
+
+/*
+ * The skip kernels return the first byte in [p, last) that the automaton
+ * has to look at.  While compressing, these are '\n', '\r', '\t', '>', a
+ * space followed by another space, and a "<!" that may start a marker; any
+ * other '<' is copied through like a plain byte.  Outside of compressed
+ * text, only a "<!" matters.  The last byte of the buffer is never
+ * skipped, since deciding on it would need the byte after the buffer.
+ */
+static unsigned char *no_newlines_skip_plain_scalar (unsigned char *p, unsigned char *last)
+{
+        while (last - p > 1) {
+                if (*p == '\n' || *p == '\r' || *p == '\t' || *p == '>'
+                    || (*p == ' ' && *(p + 1) == ' ')
+                    || (*p == '<' && *(p + 1) == '!')) {
+                        break;
+                }
+                p++;
+        }
+
+        return p;
+}
+
+
+static unsigned char *no_newlines_skip_pre_scalar (unsigned char *p, unsigned char *last)
+{
+        while (last - p > 1) {
+                p = memchr (p, '<', last - p - 1);
+                if (p == NULL) {
+                        return last - 1;
+                }
+
+                if (*(p + 1) == '!') {
+                        break;
+                }
+                p++;
+        }
+
+        return p;
+}
+
+
+/*
+ * The text skip kernels do the same for the tokenizer, in text and in
+ * tags alike: it looks at '<', '>', quotes, and any whitespace but a
+ * single space; '\v' is looked at too, as it falls among the others, and
+ * is copied through.
+ */
+static unsigned char *no_newlines_skip_text_scalar (unsigned char *p, unsigned char *last)
+{
+        while (last - p > 1) {
+                if (*p == '<' || *p == '>' || *p == '"' || *p == '\''
+                    || (*p >= '\t' && *p <= '\r')
+                    || (*p == ' ' && html_blank (*(p + 1)))) {
+                        break;
+                }
+                p++;
+        }
+
+        return p;
+}
+
+
+/*
+ * The JSON skip kernels return the first byte in [p, last) that the JSON
+ * engine has to look at, or last: outside of strings, whitespace and '"';
+ * in strings, '"' and '\\'.  No lookahead is needed.
+ */
+static unsigned char *no_newlines_skip_json_scalar (unsigned char *p, unsigned char *last)
+{
+        while (p < last) {
+                if (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t' || *p == '"') {
+                        break;
+                }
+                p++;
+        }
+
+        return p;
+}
+
+
+static unsigned char *no_newlines_skip_string_scalar (unsigned char *p, unsigned char *last)
+{
+        while (p < last) {
+                if (*p == '"' || *p == '\\') {
+                        break;
+                }
+                p++;
+        }
+
+        return p;
+}
+
+
+static int no_newlines_scalar_supported (void)
+{
+        return 1;
+}
+
+
+#if (NO_NEWLINES_X86)
+
+__attribute__ ((target ("sse2")))
+static unsigned char *no_newlines_skip_plain_sse2 (unsigned char *p, unsigned char *last)
+{
+        __m128i  v, n, m;
+        uint32_t mask;
+
+        /* each step reads 17 bytes: 16 to classify, plus one of lookahead */
+        while (last - p > 16) {
+                v = _mm_loadu_si128 ((__m128i *) p);
+                n = _mm_loadu_si128 ((__m128i *) (p + 1));
+
+                m = _mm_or_si128 (
+                        _mm_or_si128 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\n')),
+                                      _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\r'))),
+                        _mm_or_si128 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\t')),
+                                      _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('>'))));
+                m = _mm_or_si128 (m, _mm_and_si128 (
+                                          _mm_cmpeq_epi8 (v, _mm_set1_epi8 (' ')),
+                                          _mm_cmpeq_epi8 (n, _mm_set1_epi8 (' '))));
+                m = _mm_or_si128 (m, _mm_and_si128 (
+                                          _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('<')),
+                                          _mm_cmpeq_epi8 (n, _mm_set1_epi8 ('!'))));
+
+                mask = (uint32_t) _mm_movemask_epi8 (m);
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 16;
+        }
+
+        return no_newlines_skip_plain_scalar (p, last);
+}
+
+
+__attribute__ ((target ("avx2")))
+static unsigned char *no_newlines_skip_plain_avx2 (unsigned char *p, unsigned char *last)
+{
+        __m256i  v, n, m;
+        uint32_t mask;
+
+        /* each step reads 33 bytes: 32 to classify, plus one of lookahead */
+        while (last - p > 32) {
+                v = _mm256_loadu_si256 ((__m256i *) p);
+                n = _mm256_loadu_si256 ((__m256i *) (p + 1));
+
+                m = _mm256_or_si256 (
+                        _mm256_or_si256 (_mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\n')),
+                                         _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\r'))),
+                        _mm256_or_si256 (_mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\t')),
+                                         _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('>'))));
+                m = _mm256_or_si256 (m, _mm256_and_si256 (
+                                             _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (' ')),
+                                             _mm256_cmpeq_epi8 (n, _mm256_set1_epi8 (' '))));
+                m = _mm256_or_si256 (m, _mm256_and_si256 (
+                                             _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('<')),
+                                             _mm256_cmpeq_epi8 (n, _mm256_set1_epi8 ('!'))));
+
+                mask = (uint32_t) _mm256_movemask_epi8 (m);
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 32;
+        }
+
+        return no_newlines_skip_plain_sse2 (p, last);
+}
+
+
+__attribute__ ((target ("avx512f,avx512bw")))
+static unsigned char *no_newlines_skip_plain_avx512bw (unsigned char *p, unsigned char *last)
+{
+        __m512i   v, n;
+        __mmask64 mask;
+
+        /* each step reads 65 bytes: 64 to classify, plus one of lookahead */
+        while (last - p > 64) {
+                v = _mm512_loadu_si512 ((void *) p);
+                n = _mm512_loadu_si512 ((void *) (p + 1));
+
+                mask = _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\n'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\r'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\t'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('>'))
+                       | (_mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 (' '))
+                          & _mm512_cmpeq_epi8_mask (n, _mm512_set1_epi8 (' ')))
+                       | (_mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('<'))
+                          & _mm512_cmpeq_epi8_mask (n, _mm512_set1_epi8 ('!')));
+
+                if (mask) {
+                        return p + __builtin_ctzll (mask);
+                }
+                p += 64;
+        }
+
+        return no_newlines_skip_plain_avx2 (p, last);
+}
+
+
+__attribute__ ((target ("sse2")))
+static unsigned char *no_newlines_skip_pre_sse2 (unsigned char *p, unsigned char *last)
+{
+        __m128i  v, n;
+        uint32_t mask;
+
+        while (last - p > 16) {
+                v = _mm_loadu_si128 ((__m128i *) p);
+                n = _mm_loadu_si128 ((__m128i *) (p + 1));
+
+                mask = (uint32_t) _mm_movemask_epi8 (_mm_and_si128 (
+                                          _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('<')),
+                                          _mm_cmpeq_epi8 (n, _mm_set1_epi8 ('!'))));
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 16;
+        }
+
+        return no_newlines_skip_pre_scalar (p, last);
+}
+
+
+__attribute__ ((target ("avx2")))
+static unsigned char *no_newlines_skip_pre_avx2 (unsigned char *p, unsigned char *last)
+{
+        __m256i  v, n;
+        uint32_t mask;
+
+        while (last - p > 32) {
+                v = _mm256_loadu_si256 ((__m256i *) p);
+                n = _mm256_loadu_si256 ((__m256i *) (p + 1));
+
+                mask = (uint32_t) _mm256_movemask_epi8 (_mm256_and_si256 (
+                                          _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('<')),
+                                          _mm256_cmpeq_epi8 (n, _mm256_set1_epi8 ('!'))));
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 32;
+        }
+
+        return no_newlines_skip_pre_sse2 (p, last);
+}
+
+
+__attribute__ ((target ("avx512f,avx512bw")))
+static unsigned char *no_newlines_skip_pre_avx512bw (unsigned char *p, unsigned char *last)
+{
+        __m512i   v, n;
+        __mmask64 mask;
+
+        while (last - p > 64) {
+                v = _mm512_loadu_si512 ((void *) p);
+                n = _mm512_loadu_si512 ((void *) (p + 1));
+
+                mask = _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('<'))
+                       & _mm512_cmpeq_epi8_mask (n, _mm512_set1_epi8 ('!'));
+                if (mask) {
+                        return p + __builtin_ctzll (mask);
+                }
+                p += 64;
+        }
+
+        return no_newlines_skip_pre_avx2 (p, last);
+}
+
+
+__attribute__ ((target ("sse2")))
+static unsigned char *no_newlines_skip_text_sse2 (unsigned char *p, unsigned char *last)
+{
+        __m128i  v, n, m, b;
+        uint32_t mask;
+
+        while (last - p > 16) {
+                v = _mm_loadu_si128 ((__m128i *) p);
+                n = _mm_loadu_si128 ((__m128i *) (p + 1));
+
+                /* '\t' to '\r' are the bytes no more than 4 above '\t' */
+                m = _mm_sub_epi8 (v, _mm_set1_epi8 ('\t'));
+                m = _mm_cmpeq_epi8 (_mm_min_epu8 (m, _mm_set1_epi8 (4)), m);
+                b = _mm_sub_epi8 (n, _mm_set1_epi8 ('\t'));
+                b = _mm_or_si128 (_mm_cmpeq_epi8 (_mm_min_epu8 (b, _mm_set1_epi8 (4)), b),
+                                  _mm_cmpeq_epi8 (n, _mm_set1_epi8 (' ')));
+
+                m = _mm_or_si128 (m, _mm_or_si128 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 ('<')),
+                                                   _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('>'))));
+                m = _mm_or_si128 (m, _mm_or_si128 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 ('"')),
+                                                   _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\''))));
+                m = _mm_or_si128 (m, _mm_and_si128 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 (' ')), b));
+
+                mask = (uint32_t) _mm_movemask_epi8 (m);
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 16;
+        }
+
+        return no_newlines_skip_text_scalar (p, last);
+}
+
+
+__attribute__ ((target ("avx2")))
+static unsigned char *no_newlines_skip_text_avx2 (unsigned char *p, unsigned char *last)
+{
+        __m256i  v, n, m, b;
+        uint32_t mask;
+
+        while (last - p > 32) {
+                v = _mm256_loadu_si256 ((__m256i *) p);
+                n = _mm256_loadu_si256 ((__m256i *) (p + 1));
+
+                m = _mm256_sub_epi8 (v, _mm256_set1_epi8 ('\t'));
+                m = _mm256_cmpeq_epi8 (_mm256_min_epu8 (m, _mm256_set1_epi8 (4)), m);
+                b = _mm256_sub_epi8 (n, _mm256_set1_epi8 ('\t'));
+                b = _mm256_or_si256 (_mm256_cmpeq_epi8 (_mm256_min_epu8 (b, _mm256_set1_epi8 (4)),
+                                                        b),
+                                     _mm256_cmpeq_epi8 (n, _mm256_set1_epi8 (' ')));
+
+                m = _mm256_or_si256 (m, _mm256_or_si256 (
+                                             _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('<')),
+                                             _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('>'))));
+                m = _mm256_or_si256 (m, _mm256_or_si256 (
+                                             _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('"')),
+                                             _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\''))));
+                m = _mm256_or_si256 (m, _mm256_and_si256 (
+                                             _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (' ')), b));
+
+                mask = (uint32_t) _mm256_movemask_epi8 (m);
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 32;
+        }
+
+        return no_newlines_skip_text_sse2 (p, last);
+}
+
+
+__attribute__ ((target ("avx512f,avx512bw")))
+static unsigned char *no_newlines_skip_text_avx512bw (unsigned char *p, unsigned char *last)
+{
+        __m512i   v, n;
+        __mmask64 mask;
+
+        while (last - p > 64) {
+                v = _mm512_loadu_si512 ((void *) p);
+                n = _mm512_loadu_si512 ((void *) (p + 1));
+
+                mask = _mm512_cmple_epu8_mask (_mm512_sub_epi8 (v, _mm512_set1_epi8 ('\t')),
+                                               _mm512_set1_epi8 (4))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('<'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('>'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('"'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\''))
+                       | (_mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 (' '))
+                          & (_mm512_cmple_epu8_mask (_mm512_sub_epi8 (n, _mm512_set1_epi8 ('\t')),
+                                                     _mm512_set1_epi8 (4))
+                             | _mm512_cmpeq_epi8_mask (n, _mm512_set1_epi8 (' '))));
+
+                if (mask) {
+                        return p + __builtin_ctzll (mask);
+                }
+                p += 64;
+        }
+
+        return no_newlines_skip_text_avx2 (p, last);
+}
+
+
+__attribute__ ((target ("sse2")))
+static unsigned char *no_newlines_skip_json_sse2 (unsigned char *p, unsigned char *last)
+{
+        __m128i  v, m;
+        uint32_t mask;
+
+        while (last - p >= 16) {
+                v = _mm_loadu_si128 ((__m128i *) p);
+
+                m = _mm_or_si128 (
+                        _mm_or_si128 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 (' ')),
+                                      _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\n'))),
+                        _mm_or_si128 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\r')),
+                                      _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\t'))));
+                m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('"')));
+
+                mask = (uint32_t) _mm_movemask_epi8 (m);
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 16;
+        }
+
+        return no_newlines_skip_json_scalar (p, last);
+}
+
+
+__attribute__ ((target ("avx2")))
+static unsigned char *no_newlines_skip_json_avx2 (unsigned char *p, unsigned char *last)
+{
+        __m256i  v, m;
+        uint32_t mask;
+
+        while (last - p >= 32) {
+                v = _mm256_loadu_si256 ((__m256i *) p);
+
+                m = _mm256_or_si256 (
+                        _mm256_or_si256 (_mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (' ')),
+                                         _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\n'))),
+                        _mm256_or_si256 (_mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\r')),
+                                         _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\t'))));
+                m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('"')));
+
+                mask = (uint32_t) _mm256_movemask_epi8 (m);
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 32;
+        }
+
+        return no_newlines_skip_json_sse2 (p, last);
+}
+
+
+__attribute__ ((target ("avx512f,avx512bw")))
+static unsigned char *no_newlines_skip_json_avx512bw (unsigned char *p, unsigned char *last)
+{
+        __m512i   v;
+        __mmask64 mask;
+
+        while (last - p >= 64) {
+                v = _mm512_loadu_si512 ((void *) p);
+
+                mask = _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 (' '))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\n'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\r'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\t'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('"'));
+
+                if (mask) {
+                        return p + __builtin_ctzll (mask);
+                }
+                p += 64;
+        }
+
+        return no_newlines_skip_json_avx2 (p, last);
+}
+
+
+__attribute__ ((target ("sse2")))
+static unsigned char *no_newlines_skip_string_sse2 (unsigned char *p, unsigned char *last)
+{
+        __m128i  v;
+        uint32_t mask;
+
+        while (last - p >= 16) {
+                v = _mm_loadu_si128 ((__m128i *) p);
+
+                mask = (uint32_t) _mm_movemask_epi8 (_mm_or_si128 (
+                                          _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('"')),
+                                          _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\\'))));
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 16;
+        }
+
+        return no_newlines_skip_string_scalar (p, last);
+}
+
+
+__attribute__ ((target ("avx2")))
+static unsigned char *no_newlines_skip_string_avx2 (unsigned char *p, unsigned char *last)
+{
+        __m256i  v;
+        uint32_t mask;
+
+        while (last - p >= 32) {
+                v = _mm256_loadu_si256 ((__m256i *) p);
+
+                mask = (uint32_t) _mm256_movemask_epi8 (_mm256_or_si256 (
+                                          _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('"')),
+                                          _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\\'))));
+                if (mask) {
+                        return p + __builtin_ctz (mask);
+                }
+                p += 32;
+        }
+
+        return no_newlines_skip_string_sse2 (p, last);
+}
+
+
+__attribute__ ((target ("avx512f,avx512bw")))
+static unsigned char *no_newlines_skip_string_avx512bw (unsigned char *p, unsigned char *last)
+{
+        __m512i   v;
+        __mmask64 mask;
+
+        while (last - p >= 64) {
+                v = _mm512_loadu_si512 ((void *) p);
+
+                mask = _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('"'))
+                       | _mm512_cmpeq_epi8_mask (v, _mm512_set1_epi8 ('\\'));
+                if (mask) {
+                        return p + __builtin_ctzll (mask);
+                }
+                p += 64;
+        }
+
+        return no_newlines_skip_string_avx2 (p, last);
+}
+
+
+static int no_newlines_sse2_supported (void)
+{
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("sse2");
+}
+
+
+static int no_newlines_avx2_supported (void)
+{
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("avx2");
+}
+
+
+static int no_newlines_avx512bw_supported (void)
+{
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("avx512bw");
+}
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * The stripping engine of the no_newlines module, as a plain C library
+ * with no dependency on NginX.  Text is fed in spans of any size; the
+ * result does not depend on how the text is split.
+ *
+ *      no_newlines_init_tables ();
+ *      no_newlines_use_kernel (no_newlines_kernel_auto);
+ *
+ *      no_newlines_init (&nl, no_newlines_mode_html, NULL);
+ *      for (each span of the text) {
+ *              end = no_newlines_feed (&nl, span, len, out);
+ *      }
+ *      end = no_newlines_finish (&nl, out);
+ */
+
+#ifndef _NO_NEWLINES_H_INCLUDED_
+#define _NO_NEWLINES_H_INCLUDED_
+
+#include <stddef.h>
+
+#define NO_NEWLINES_SC_OFF  "<!--SC_OFF-->"
+#define NO_NEWLINES_SC_ON   "<!--SC_ON-->"
+
+/* The longest marker, or prefix of a comment kept, with its "<!--" */
+#define NO_NEWLINES_PATTERN_MAX  48
+
+/* The most that no_newlines_finish() writes, and no_newlines_pending() returns */
+#define NO_NEWLINES_PENDING_MAX  (NO_NEWLINES_PATTERN_MAX + 1)
+
+/* The most pairs of markers that can be set */
+#define NO_NEWLINES_MARKERS_MAX  8
+
+/* The longest element name, and the most elements, that can be preserved */
+#define NO_NEWLINES_NAME_MAX      16
+#define NO_NEWLINES_ELEMENTS_MAX  16
+
+/* Room for the matcher of markers: states, and byte classes told apart */
+#define NO_NEWLINES_MATCH_STATES   256
+#define NO_NEWLINES_MATCH_CLASSES  48
+
+/* Engines, each for a kind of text */
+typedef enum {
+        no_newlines_mode_html = 0,
+        no_newlines_mode_xml,
+        no_newlines_mode_json,
+        no_newlines_mode_css,
+        no_newlines_mode_js
+} no_newlines_mode_e;
+
+/*
+ * Options of the HTML and XML engine, built once and shared by all the
+ * texts stripped with them.  Text stripped without options goes through
+ * the automaton; text stripped with them, through a tokenizer that knows
+ * tags from text.
+ */
+typedef struct {
+        /* HTML elements whose content is kept as it is, lowercased */
+        unsigned int  nelements;
+        unsigned char elements[NO_NEWLINES_ELEMENTS_MAX][NO_NEWLINES_NAME_MAX];
+        unsigned char lengths[NO_NEWLINES_ELEMENTS_MAX];
+
+        /* the pairs of markers set, or 0 for SC_OFF and SC_ON */
+        unsigned int  nmarkers;
+
+        /* whether markers are written out rather than dropped */
+        unsigned int  markers_kept;
+
+        /* whether comments are dropped */
+        unsigned int  comments;
+
+        /* whether whitespace next to block-level tags is dropped */
+        unsigned int  blocks;
+
+        /* how much more than whitespace is taken out of HTML, from 1 */
+        unsigned int  level;
+
+        /* the markers, and the starts of comments kept, matched without */
+        /* regard to case from their '<' */
+        unsigned int  nstates;
+        unsigned int  nclasses;
+        unsigned char classes[256];
+        unsigned char next[NO_NEWLINES_MATCH_STATES][NO_NEWLINES_MATCH_CLASSES];
+        unsigned char matched[NO_NEWLINES_MATCH_STATES];
+} no_newlines_conf_t;
+
+typedef struct {
+        const no_newlines_conf_t *conf;
+        unsigned char mode;
+        unsigned char state;
+        unsigned char prev;  /* the last byte written that counts, for CSS and JS, or the
+                                quote of the list of words HTML is in */
+        unsigned char flags; /* what CSS and JS have seen but not written yet */
+        unsigned char nhold;
+        unsigned char hold[NO_NEWLINES_PATTERN_MAX]; /* a candidate marker, a tag or a
+                                                        value held back */
+        unsigned char match; /* the state of the matcher over the bytes held */
+        unsigned char nword; /* the identifier JS, or the tag name HTML, has just written */
+        unsigned char word[NO_NEWLINES_NAME_MAX];
+        unsigned char element; /* the preserved element HTML is in, from 1 */
+        unsigned char closing; /* how much of its closing tag, or of the "-->" of a
+                                  comment HTML drops, has been seen; or the
+                                  end tag HTML may leave out */
+        unsigned char marker; /* the pair of markers HTML is between */
+        unsigned char depth; /* the template literals JS is in a ${} of */
+        unsigned char braces[8]; /* the '{' open in each */
+        unsigned char parens; /* the '(' open in the head of an if, for, while or with
+                                 JS is in */
+} no_newlines_t;
+
+/* Scan kernels, from the slowest to the fastest */
+typedef enum {
+        no_newlines_kernel_auto = 0,
+        no_newlines_kernel_scalar,
+        no_newlines_kernel_sse2,
+        no_newlines_kernel_avx2,
+        no_newlines_kernel_avx512bw
+} no_newlines_kernel_e;
+
+/* Builds the tables of the automaton; called once, before anything else */
+void no_newlines_init_tables (void);
+
+/* The name of a kernel, or NULL if it is not built for this platform */
+const char *no_newlines_kernel_name (no_newlines_kernel_e kernel);
+
+/* Whether the CPU can run a kernel */
+int no_newlines_kernel_supported (no_newlines_kernel_e kernel);
+
+/*
+ * Binds a kernel for all the text stripped from then on, or the fastest
+ * supported one for no_newlines_kernel_auto, or for a kernel that is not
+ * supported.  Returns the kernel bound.  Until then, the scalar one is.
+ */
+no_newlines_kernel_e no_newlines_use_kernel (no_newlines_kernel_e kernel);
+
+/* Starts on options that strip as the automaton does, with the SC markers */
+void no_newlines_conf_init (no_newlines_conf_t *conf);
+
+/*
+ * Keeps what is between two markers as it is, as between SC_OFF and SC_ON,
+ * which the first pair set replaces; what an off marker starts, only its
+ * own on marker ends.  Markers are matched without regard to case, and
+ * start with a '<' that does not start a tag, as "<!--" does.  Pairs are
+ * set before comments are dropped.  Returns -1 if a marker is too long or
+ * does not start so, starts with or is the start of another, or there are
+ * too many.
+ */
+int no_newlines_conf_markers (no_newlines_conf_t *conf, const unsigned char *off,
+                              size_t off_len, const unsigned char *on, size_t on_len);
+
+/* Writes markers out along with what is between them, rather than dropping them */
+void no_newlines_conf_keep_markers (no_newlines_conf_t *conf);
+
+/*
+ * Keeps the content of an HTML element as it is, up to its closing tag.
+ * Returns -1 if the name is empty or too long, or there are too many.
+ */
+int no_newlines_conf_element (no_newlines_conf_t *conf, const unsigned char *name,
+                              size_t len);
+
+/*
+ * Sets how much is taken out of HTML: at 1, only whitespace; at 2, also
+ * the quotes of attribute values that can do without, and the values of
+ * boolean attributes, as in checked="checked"; at 3, also the end tags
+ * that the next tag makes implicit, such as </li> before <li>.  Returns
+ * -1 for any other level.
+ */
+int no_newlines_conf_level (no_newlines_conf_t *conf, unsigned int level);
+
+/*
+ * Drops the whitespace before and after the tags of block-level elements
+ * in HTML, such as div, p, li and td, rather than collapsing it
+ */
+void no_newlines_conf_blocks (no_newlines_conf_t *conf);
+
+/*
+ * Drops comments, but for the markers, the conditional comments of old
+ * versions of Internet Explorer, and those kept by
+ * no_newlines_conf_comment()
+ */
+void no_newlines_conf_comments (no_newlines_conf_t *conf);
+
+/*
+ * Keeps, when comments are dropped, those that start with the given text.
+ * Returns -1 if the text is empty or too long, clashes with a marker or
+ * another one, or there are too many.
+ */
+int no_newlines_conf_comment (no_newlines_conf_t *conf, const unsigned char *prefix,
+                              size_t len);
+
+/*
+ * Starts on a text, to be stripped by the engine for its kind, with the
+ * given options for HTML and XML, or none
+ */
+void no_newlines_init (no_newlines_t *nl, no_newlines_mode_e mode,
+                       const no_newlines_conf_t *conf);
+
+/*
+ * Strips len bytes at in, writing the result to out, and returns the end
+ * of what was written: at most len + no_newlines_pending() bytes.  Writing
+ * over the input (out == in) is safe while no_newlines_pending() is 0.
+ */
+unsigned char *no_newlines_feed (no_newlines_t *nl, unsigned char *in, size_t len,
+                                 unsigned char *out);
+
+/* Writes out what is pending at the end of the text, and starts over */
+unsigned char *no_newlines_finish (no_newlines_t *nl, unsigned char *out);
+
+/* How many bytes may still be written on account of text already fed */
+size_t no_newlines_pending (no_newlines_t *nl);
+
+/* Whether the text fed so far ends between markers */
+int no_newlines_preserving (no_newlines_t *nl);
+
+#endif /* _NO_NEWLINES_H_INCLUDED_ */
@@ -0,0 +1,974 @@
+/*
+ * Measures the stripping engine, for every scan kernel the CPU supports,
+ * over the given files and a set of synthetic inputs of varying whitespace
+ * density and marker frequency, fed in chunks of 512 bytes to 1 megabyte.
+ * The results are written to the standard output as a JSON array; cycles
+ * are those of the time stamp counter, and are null where there is none.
+ * The engine is that for HTML unless another is given with -m.  HTML is
+ * stripped by the tokenizer with any of the options of the module's
+ * directives: -p keeps the given elements as they are, -M sets the given
+ * pairs of markers, -K keeps markers, -C drops comments but for those
+ * that start with the given prefixes ('' for none), -b drops whitespace
+ * by block-level tags, and -l sets the level.
+ *
+ *      no_newlines_bench [-S] [-t msec] [-s size] [-k kernel] [-c chunk]
+ *                        [-m engine] [-p element,...] [-M off,on,...] [-K]
+ *                        [-C prefix,...] [-b] [-l level] [file...]
+ *
+ * With -V, it checks instead that every kernel of every engine, fed the
+ * text split at random, gives the same output and final state as a
+ * reference run on the whole text at once: for HTML and XML, the
+ * byte-at-a-time loop that the module started out with; for JSON, a
+ * loop that only tracks strings; for the others, and for the HTML and XML
+ * tokenizer, the engine itself, which is first checked against texts
+ * whose stripped form is known.  Random documents are made up of
+ * fragments that exercise the corner cases, and any files given are
+ * checked as well; a mismatch aborts, so that it can be driven by AFL, as
+ * in "-V 0 @@".  Built with -DBENCH_FUZZER, the check is the entry point
+ * of a libFuzzer target, and the rest is left out.
+ *
+ *      no_newlines_bench -V count [file...]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#if ((defined __x86_64__ || defined __i386__) && defined __GNUC__)
+#define BENCH_TSC  1
+#include <x86intrin.h>
+#endif
+
+#include "no_newlines.h"
+
+typedef struct {
+        const char     *name;
+        unsigned char  *data;
+        size_t          len;
+} bench_input_t;
+
+typedef struct {
+        const char *name;
+        double      density;   /* of runs of whitespace among the bytes */
+        unsigned    markers;   /* per megabyte, SC_OFF and SC_ON in turn */
+} bench_synthetic_t;
+
+typedef struct {
+        int                        mode;
+        const no_newlines_conf_t  *conf;
+        const char                *in;
+        const char                *out;
+} bench_golden_t;
+
+#if !(BENCH_FUZZER)
+static int bench_read (bench_input_t *in, const char *name);
+static void bench_generate (bench_input_t *in, bench_synthetic_t *syn, size_t size);
+static void bench_run (bench_input_t *in, no_newlines_kernel_e kernel, size_t chunk);
+static double bench_now (void);
+#endif
+static uint32_t bench_random (void);
+static void bench_verify (unsigned char *data, size_t len);
+static void bench_golden (void);
+static void bench_verify_engine (unsigned char *data, size_t len, int mode,
+                                 const no_newlines_conf_t *conf);
+static size_t bench_reference (unsigned char *data, size_t len, unsigned char *out,
+                               int *preserving);
+static int bench_reference_space (unsigned char *p);
+static size_t bench_reference_json (unsigned char *data, size_t len, unsigned char *out);
+static size_t bench_reference_whole (unsigned char *data, size_t len, unsigned char *out,
+                                     int mode, const no_newlines_conf_t *conf,
+                                     int *preserving);
+static void bench_elements (no_newlines_conf_t *conf, const char *list);
+static void bench_comments (no_newlines_conf_t *conf, const char *list);
+static void bench_markers (no_newlines_conf_t *conf, const char *list);
+
+static uint32_t            bench_seed = 2463534242u;
+static no_newlines_conf_t  bench_conf;
+static no_newlines_conf_t  bench_stripping;   /* the same, with a second pair of */
+                                              /* markers kept, dropping comments and */
+                                              /* space by blocks, at level 3, for -V */
+
+#if !(BENCH_FUZZER)
+
+static size_t bench_chunks[] = {
+        512, 4096, 16384, 65536, 262144, 1048576, 0
+};
+
+static bench_synthetic_t  bench_synthetic[] = {
+        { "synthetic-sparse",       0.01,    0 },
+        { "synthetic-typical",      0.03,    0 },
+        { "synthetic-dense",        0.10,    0 },
+        { "synthetic-markers",      0.03,   64 },
+        { "synthetic-many-markers", 0.03, 4096 },
+        { NULL, 0, 0 }
+};
+
+static double          bench_min_time = 0.2;   /* seconds per measurement */
+static unsigned char  *bench_out;
+static int             bench_first = 1;
+static int             bench_mode = no_newlines_mode_html;
+static const char     *bench_options = "";
+static const char     *bench_kept;            /* the comments kept, if they are dropped */
+static const char     *bench_pairs;           /* the markers, if not SC_OFF and SC_ON */
+static int             bench_blocks;
+static int             bench_kept_markers;
+static int             bench_level = 1;
+static no_newlines_conf_t *bench_tokenizer;   /* the options timed, if any */
+
+#endif
+
+/*
+ * Texts and what they must be stripped into, for the engines whose
+ * reference in -V is the engine itself
+ */
+static bench_golden_t  bench_goldens[] = {
+        /* a '/' after an operand divides */
+        { no_newlines_mode_js, NULL, "x = i++ / 2 / y", "x=i++/2/y" },
+        { no_newlines_mode_js, NULL, "x = i-- / 2; s = \"a  /  b\"", "x=i--/2;s=\"a  /  b\"" },
+        { no_newlines_mode_js, NULL, "x = i++ / 2; y = \"a/b // c\"; z = 1\nw = 2",
+          "x=i++/2;y=\"a/b // c\";z=1\nw=2" },
+        { no_newlines_mode_js, NULL, "x = a[0] / 2 / y", "x=a[0]/2/y" },
+        { no_newlines_mode_js, NULL, "x = f() / 2 / y", "x=f()/2/y" },
+
+        /* and one after an operator, a keyword or a head starts a regex */
+        { no_newlines_mode_js, NULL, "return /a  b/g", "return/a  b/g" },
+        { no_newlines_mode_js, NULL, "f( /a  b/ )", "f(/a  b/)" },
+        { no_newlines_mode_js, NULL, "a = b + /a  b/.test(c)", "a=b+/a  b/.test(c)" },
+        { no_newlines_mode_js, NULL, "a = b++ + /a  b/.test(c)", "a=b++ +/a  b/.test(c)" },
+        { no_newlines_mode_js, NULL, "if (a) /a  b/.test(s)", "if(a)/a  b/.test(s)" },
+        { no_newlines_mode_js, NULL, "while (f(x)) /a  b/.exec(s)",
+          "while(f(x))/a  b/.exec(s)" },
+
+        /* line ends that automatic semicolon insertion may depend on */
+        { no_newlines_mode_js, NULL, "a = b\n  c = d", "a=b\nc=d" },
+        { no_newlines_mode_js, NULL, "a = b\n(c)", "a=b\n(c)" },
+        { no_newlines_mode_js, NULL, "a = b\n[1]", "a=b\n[1]" },
+        { no_newlines_mode_js, NULL, "a = b\n++c", "a=b\n++c" },
+        { no_newlines_mode_js, NULL, "return\nx", "return\nx" },
+        { no_newlines_mode_js, NULL, "x = 1\n.5", "x=1\n.5" },
+        { no_newlines_mode_js, NULL, "a\n  .b()", "a.b()" },
+
+        /* templates, which are copied as they are once nested too deep */
+        { no_newlines_mode_js, NULL, "a = `x  ${ b  +  c }  y`", "a=`x  ${b+c}  y`" },
+        { no_newlines_mode_js, NULL, "`${`${`${`${`${`${`${`${ a  +  b }`}`}`}`}`}`}`}`  +  x",
+          "`${`${`${`${`${`${`${`${a+b}`}`}`}`}`}`}`}`+x" },
+        { no_newlines_mode_js, NULL,
+          "`${`${`${`${`${`${`${`${`${ a  b }`}`}`}`}`}`}`}`}`  x",
+          "`${`${`${`${`${`${`${`${`${ a  b }`}`}`}`}`}`}`}`}`  x" },
+
+        { no_newlines_mode_css, NULL,
+          "a  >  b ,  c {\n  color : red ;\n  background : url( a.png ) ;\n}\n"
+          "/* c */\np{margin:0 ;}",
+          "a>b,c{color :red;background :url(a.png)}p{margin:0}" },
+        { no_newlines_mode_css, NULL, "p { content: \"a  ;  b\" }", "p{content:\"a  ;  b\"}" },
+
+        { no_newlines_mode_html, &bench_conf,
+          "<div  id = \"a  b\"  class=\" x   y \">\n  <p> t  t </p>\n"
+          "  <pre>  k  \n</pre>\n  <script> a  =  1 </script>\n</div>",
+          "<div id=\"a  b\" class=\"x y\"><p> t t </p><pre>  k  \n"
+          "</pre><script> a  =  1 </script></div>" },
+        { no_newlines_mode_html, &bench_stripping,
+          "<ul>\n  <li> a </li>\n  <li> b </li>\n</ul>\n<!-- c -->\n<p>x</p>\n"
+          "<my-el><p>y</p></my-el>",
+          "<ul><li>a<li>b</ul><p>x</p><my-el><p>y</p></my-el>" },
+        { no_newlines_mode_html, &bench_stripping,
+          "<input  checked=\"checked\"  value=\"v\">", "<input checked value=v>" },
+
+        { 0, NULL, NULL, NULL }
+};
+
+/* Names of the engines, indexed by no_newlines_mode_e */
+static const char  *bench_modes[] = {
+        "html", "xml", "json", "css", "js", NULL
+};
+
+
+#if (BENCH_FUZZER)
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t len)
+{
+        static int  inited;
+
+        if (!inited) {
+                no_newlines_init_tables ();
+                bench_elements (&bench_conf, "pre,textarea,script,style");
+                bench_elements (&bench_stripping, "pre,textarea,script,style");
+                bench_markers (&bench_stripping, NO_NEWLINES_SC_OFF "," NO_NEWLINES_SC_ON
+                                                 ",<!--nomin-->,<!--/nomin-->");
+                bench_comments (&bench_stripping, "keep");
+                no_newlines_conf_blocks (&bench_stripping);
+                no_newlines_conf_keep_markers (&bench_stripping);
+                no_newlines_conf_level (&bench_stripping, 3);
+                bench_golden ();
+                inited = 1;
+        }
+
+        bench_seed = len * 2654435761u + 1;
+        bench_verify ((unsigned char *) data, len);
+
+        return 0;
+}
+
+#else
+
+/* What random documents for -V are made of */
+static const char  *bench_fragments[] = {
+        "<!--SC_OFF-->", "<!--SC_ON-->", "<!--sc_off-->", "<!--Sc_On-->",
+        "<!--SC_O", "<!--SC_", "<!-", "<!", "<", ">", "<p>", "</p>",
+        " ", "  ", "\n", "\t", "\r", "a", "text", "<!-- x -->",
+        "\"", "\\", "\\\"", "{", "}", "[1, 2]", ": ", ",",
+        "/*", "*/", "/", "*", ";", " ;", ";}", "'", "url(", "URL( x )", ")",
+        "`", "${", "//", "return", " /[/]\\//g", "x = ", "++", "1 .5", "(", "]",
+        "<pre>", "</pre>", "<PRE class=x>", "</pre ", "</", "<textarea>", "</textarea>",
+        "<script>", "</script>", "</scrip", "<style>", "</STYLE>", "<br/>", "<a href=",
+        "=", "='", "= \"", "x>y", "<div  \n id = \"a  b\" >",
+        "<!--[if IE]>", "<![endif]-->", "<!--<![endif]-->", "<!--keep-->", "<!--KEEP ",
+        "<!---->", "<!-->", "-->", "--", "-", " <!-- a -- b --> ",
+        "<div>", "</div> ", " <li class=a>", "<span>", " </td>", "<Blockquote",
+        "<abcdefghijklmnopq", " checked=\"Checked\"", " selected=''", "=\"x\"", "\"ab\"",
+        "</li>", "<li>", "</p> ", "</td>", "</option>", "/>", " = ",
+        "<!--nomin-->", "<!--/nomin-->", "<!--NoMin",
+        "<p class=\"", " class= ' a  b ' ", " rel", " /", "\" >",
+        "<my-el>", "</my-el>", "</span>",
+        "if (a) ", "while", "for (", "f(x)", " / re  x/", "x = 1\n.5", "\n.", "..."
+};
+
+
+int main (int argc, char **argv)
+{
+        int                   i, synthetic;
+        long                  verify, n;
+        size_t                size, chunk, c, len;
+        const char           *kernel_name;
+        bench_input_t         in;
+        no_newlines_kernel_e  k;
+        unsigned char         doc[4096];
+
+        synthetic = 1;
+        size = 4 * 1024 * 1024;
+        kernel_name = NULL;
+        chunk = 0;
+        verify = -1;
+
+        for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+                if (strcmp (argv[i], "-S") == 0) {
+                        synthetic = 0;
+
+                } else if (strcmp (argv[i], "-V") == 0 && i + 1 < argc) {
+                        verify = atol (argv[++i]);
+
+                } else if (strcmp (argv[i], "-t") == 0 && i + 1 < argc) {
+                        bench_min_time = atof (argv[++i]) / 1000;
+
+                } else if (strcmp (argv[i], "-s") == 0 && i + 1 < argc) {
+                        size = strtoul (argv[++i], NULL, 10);
+
+                } else if (strcmp (argv[i], "-k") == 0 && i + 1 < argc) {
+                        kernel_name = argv[++i];
+
+                } else if (strcmp (argv[i], "-c") == 0 && i + 1 < argc) {
+                        chunk = strtoul (argv[++i], NULL, 10);
+
+                } else if (strcmp (argv[i], "-m") == 0 && i + 1 < argc) {
+                        for (bench_mode = 0; bench_modes[bench_mode]; bench_mode++) {
+                                if (strcmp (argv[i + 1], bench_modes[bench_mode]) == 0) {
+                                        break;
+                                }
+                        }
+
+                        if (bench_modes[bench_mode] == NULL) {
+                                fprintf (stderr, "no_newlines_bench: unknown engine \"%s\"\n",
+                                         argv[i + 1]);
+                                return 2;
+                        }
+
+                        i++;
+
+                } else if (strcmp (argv[i], "-p") == 0 && i + 1 < argc) {
+                        bench_options = argv[++i];
+                        bench_tokenizer = &bench_conf;
+
+                } else if (strcmp (argv[i], "-C") == 0 && i + 1 < argc) {
+                        bench_kept = argv[++i];
+                        bench_tokenizer = &bench_conf;
+
+                } else if (strcmp (argv[i], "-M") == 0 && i + 1 < argc) {
+                        bench_pairs = argv[++i];
+                        bench_tokenizer = &bench_conf;
+
+                } else if (strcmp (argv[i], "-K") == 0) {
+                        bench_kept_markers = 1;
+                        bench_tokenizer = &bench_conf;
+
+                } else if (strcmp (argv[i], "-b") == 0) {
+                        bench_blocks = 1;
+                        bench_tokenizer = &bench_conf;
+
+                } else if (strcmp (argv[i], "-l") == 0 && i + 1 < argc) {
+                        bench_level = atoi (argv[++i]);
+                        bench_tokenizer = &bench_conf;
+
+                } else {
+                        fprintf (stderr, "usage: no_newlines_bench [-S] [-t msec] [-s size] "
+                                         "[-k kernel] [-c chunk] [-m engine] [-p element,...] "
+                                         "[-M off,on,...] [-K] [-C prefix,...] [-b] [-l level] "
+                                         "[file...]\n"
+                                         "       no_newlines_bench -V count [file...]\n");
+                        return 2;
+                }
+        }
+
+        if (verify >= 0) {
+                no_newlines_init_tables ();
+                bench_elements (&bench_conf, "pre,textarea,script,style");
+                bench_elements (&bench_stripping, "pre,textarea,script,style");
+                bench_markers (&bench_stripping, NO_NEWLINES_SC_OFF "," NO_NEWLINES_SC_ON
+                                                 ",<!--nomin-->,<!--/nomin-->");
+                bench_comments (&bench_stripping, "keep");
+                no_newlines_conf_blocks (&bench_stripping);
+                no_newlines_conf_keep_markers (&bench_stripping);
+                no_newlines_conf_level (&bench_stripping, 3);
+
+                bench_golden ();
+
+                for (n = 0; n < verify; n++) {
+                        len = 0;
+
+                        for (c = bench_random () % 64; c; c--) {
+                                const char  *f = bench_fragments[bench_random ()
+                                                 % (sizeof(bench_fragments) / sizeof(char *))];
+
+                                if (len + strlen (f) > sizeof(doc)) {
+                                        break;
+                                }
+
+                                memcpy (doc + len, f, strlen (f));
+                                len += strlen (f);
+                        }
+
+                        bench_verify (doc, len);
+                }
+
+                for ( /* void */ ; i < argc; i++) {
+                        if (bench_read (&in, argv[i]) != 0) {
+                                return 1;
+                        }
+
+                        for (n = 0; n < 16; n++) {
+                                bench_verify (in.data, in.len);
+                        }
+
+                        free (in.data);
+                }
+
+                printf ("{\"verified\": %ld, \"mismatches\": 0}\n", verify);
+
+                return 0;
+        }
+
+        if (chunk) {
+                bench_chunks[0] = chunk;
+                bench_chunks[1] = 0;
+        }
+
+        /* the output of a chunk is at most the chunk and what is pending */
+        bench_out = malloc ((chunk > 1048576 ? chunk : 1048576) + NO_NEWLINES_PENDING_MAX);
+        if (bench_out == NULL) {
+                perror ("no_newlines_bench");
+                return 1;
+        }
+
+        no_newlines_init_tables ();
+        bench_elements (&bench_conf, bench_options);
+
+        if (bench_pairs) {
+                bench_markers (&bench_conf, bench_pairs);
+        }
+
+        if (bench_kept_markers) {
+                no_newlines_conf_keep_markers (&bench_conf);
+        }
+
+        if (bench_kept) {
+                bench_comments (&bench_conf, bench_kept);
+        }
+
+        if (bench_blocks) {
+                no_newlines_conf_blocks (&bench_conf);
+        }
+
+        if (no_newlines_conf_level (&bench_conf, bench_level) != 0) {
+                fprintf (stderr, "no_newlines_bench: invalid level %d\n", bench_level);
+                return 2;
+        }
+
+        printf ("[");
+
+        for ( ;; ) {
+                if (i < argc) {
+                        if (bench_read (&in, argv[i++]) != 0) {
+                                return 1;
+                        }
+
+                } else if (synthetic && bench_synthetic[synthetic - 1].name) {
+                        bench_generate (&in, &bench_synthetic[synthetic - 1], size);
+                        synthetic++;
+
+                } else {
+                        break;
+                }
+
+                for (k = no_newlines_kernel_scalar; no_newlines_kernel_name (k); k++) {
+                        if (!no_newlines_kernel_supported (k)
+                            || (kernel_name
+                                && strcmp (kernel_name, no_newlines_kernel_name (k)) != 0)) {
+                                continue;
+                        }
+
+                        no_newlines_use_kernel (k);
+
+                        for (c = 0; bench_chunks[c]; c++) {
+                                bench_run (&in, k, bench_chunks[c]);
+                        }
+                }
+
+                free (in.data);
+        }
+
+        printf ("\n]\n");
+
+        return 0;
+}
+
+
+static int bench_read (bench_input_t *in, const char *name)
+{
+        FILE   *f;
+        long    len;
+
+        f = fopen (name, "rb");
+        if (f == NULL || fseek (f, 0, SEEK_END) != 0 || (len = ftell (f)) < 0) {
+                perror (name);
+                return -1;
+        }
+
+        rewind (f);
+
+        in->name = name;
+        in->len = len;
+        in->data = malloc (len ? len : 1);
+
+        if (in->data == NULL || fread (in->data, 1, len, f) != (size_t) len) {
+                perror (name);
+                return -1;
+        }
+
+        fclose (f);
+
+        return 0;
+}
+
+
+/*
+ * Words and tags separated by spaces, with runs of whitespace starting at
+ * density of the bytes, and markers at even intervals.
+ */
+static void bench_generate (bench_input_t *in, bench_synthetic_t *syn, size_t size)
+{
+        size_t          n, run, every;
+        unsigned char  *p, *last;
+        static const char  *tags[] = { "<p>", "</p>", "<div class=\"x\">", "</div>",
+                                       "<a href=\"/\">", "</a>", "<li>", "</li>" };
+        static const char   ws[] = " \n\t\r";
+
+        in->name = syn->name;
+        in->len = size;
+        in->data = malloc (size + 64);
+
+        if (in->data == NULL) {
+                perror ("no_newlines_bench");
+                exit (1);
+        }
+
+        every = syn->markers ? (size_t) (1024 * 1024 / syn->markers) : 0;
+
+        p = in->data;
+        last = in->data + size;
+        n = 0;
+
+        while (p < last) {
+                if (every && (size_t) (p - in->data) / every >= n) {
+                        n++;
+                        memcpy (p, (n & 1) ? NO_NEWLINES_SC_OFF : NO_NEWLINES_SC_ON,
+                                (n & 1) ? sizeof(NO_NEWLINES_SC_OFF) - 1
+                                        : sizeof(NO_NEWLINES_SC_ON) - 1);
+                        p += (n & 1) ? sizeof(NO_NEWLINES_SC_OFF) - 1
+                                     : sizeof(NO_NEWLINES_SC_ON) - 1;
+                        continue;
+                }
+
+                if (bench_random () % 1000 < syn->density * 1000) {
+                        /* indentation and line ends come in runs */
+                        for (run = 1 + bench_random () % 8; run && p < last; run--) {
+                                *p++ = ws[bench_random () % 4];
+                        }
+                        continue;
+                }
+
+                if (bench_random () % 16 == 0) {
+                        strcpy ((char *) p, tags[bench_random () % 8]);
+                        p += strlen ((char *) p);
+                        continue;
+                }
+
+                *p++ = 'a' + bench_random () % 26;
+
+                if (bench_random () % 6 == 0) {
+                        *p++ = ' ';
+                }
+        }
+}
+
+
+static void bench_run (bench_input_t *in, no_newlines_kernel_e kernel, size_t chunk)
+{
+        size_t          runs, out, n;
+        double          start, elapsed;
+        unsigned char  *p, *last;
+        no_newlines_t   nl;
+#if (BENCH_TSC)
+        uint64_t        cycles;
+#endif
+
+        runs = 0;
+        out = 0;
+        start = bench_now ();
+#if (BENCH_TSC)
+        cycles = __rdtsc ();
+#endif
+
+        do {
+                no_newlines_init (&nl, bench_mode, bench_tokenizer);
+                out = 0;
+
+                for (p = in->data, last = in->data + in->len; p < last; p += n) {
+                        n = (size_t) (last - p) < chunk ? (size_t) (last - p) : chunk;
+                        out += no_newlines_feed (&nl, p, n, bench_out) - bench_out;
+                }
+
+                out += no_newlines_finish (&nl, bench_out) - bench_out;
+                runs++;
+
+                elapsed = bench_now () - start;
+
+        } while (elapsed < bench_min_time);
+
+#if (BENCH_TSC)
+        cycles = __rdtsc () - cycles;
+#endif
+
+        printf ("%s\n  {\"input\": \"%s\", \"bytes\": %zu, \"engine\": \"%s\", "
+                "\"preserve\": \"%s\", \"markers\": %s%s%s, \"kept_markers\": %s, "
+                "\"comments\": %s%s%s, \"blocks\": %s, \"level\": %d, "
+                "\"kernel\": \"%s\", \"chunk\": %zu, \"runs\": %zu, \"gb_per_s\": %.3f, ",
+                bench_first ? "" : ",", in->name, in->len, bench_modes[bench_mode], bench_options,
+                bench_pairs ? "\"" : "", bench_pairs ? bench_pairs : "null",
+                bench_pairs ? "\"" : "",
+                bench_kept_markers ? "true" : "false",
+                bench_kept ? "\"" : "", bench_kept ? bench_kept : "null", bench_kept ? "\"" : "",
+                bench_blocks ? "true" : "false", bench_level,
+                no_newlines_kernel_name (kernel), chunk, runs,
+                (double) in->len * runs / elapsed / 1e9);
+
+#if (BENCH_TSC)
+        printf ("\"cycles_per_byte\": %.3f, ", in->len ? (double) cycles / runs / in->len : 0);
+#else
+        printf ("\"cycles_per_byte\": null, ");
+#endif
+
+        printf ("\"ratio\": %.4f}", in->len ? (double) out / in->len : 1);
+
+        bench_first = 0;
+}
+
+
+static double bench_now (void)
+{
+        struct timespec ts;
+
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif
+
+
+/* A fixed sequence, so that the synthetic inputs are the same every run */
+static uint32_t bench_random (void)
+{
+        bench_seed ^= bench_seed << 13;
+        bench_seed ^= bench_seed >> 17;
+        bench_seed ^= bench_seed << 5;
+
+        return bench_seed;
+}
+
+
+static void bench_verify (unsigned char *data, size_t len)
+{
+        int  m;
+
+        for (m = 0; bench_modes[m]; m++) {
+                bench_verify_engine (data, len, m, NULL);
+        }
+
+        bench_verify_engine (data, len, no_newlines_mode_html, &bench_conf);
+        bench_verify_engine (data, len, no_newlines_mode_xml, &bench_conf);
+        bench_verify_engine (data, len, no_newlines_mode_html, &bench_stripping);
+        bench_verify_engine (data, len, no_newlines_mode_xml, &bench_stripping);
+}
+
+
+/* Checks the engines against the texts known stripped, then split at random */
+static void bench_golden (void)
+{
+        int              preserving;
+        size_t           len, olen;
+        unsigned char   *in, *out;
+        bench_golden_t  *g;
+
+        for (g = bench_goldens; g->in; g++) {
+                len = strlen (g->in);
+
+                in = malloc (len + 1);
+                out = malloc (len + NO_NEWLINES_PENDING_MAX + 1);
+
+                if (in == NULL || out == NULL) {
+                        perror ("no_newlines_bench");
+                        exit (1);
+                }
+
+                memcpy (in, g->in, len);
+
+                olen = bench_reference_whole (in, len, out, g->mode, g->conf, &preserving);
+
+                if (olen != strlen (g->out) || memcmp (out, g->out, olen) != 0) {
+                        fprintf (stderr, "no_newlines_bench: %s%s mismatch on:\n%s\n"
+                                 "expected:\n%s\ngot:\n", bench_modes[g->mode],
+                                 g->conf ? " with options" : "", g->in, g->out);
+                        fwrite (out, 1, olen, stderr);
+                        fprintf (stderr, "\n");
+                        abort ();
+                }
+
+                bench_verify_engine (in, len, g->mode, g->conf);
+
+                free (in);
+                free (out);
+        }
+}
+
+
+/*
+ * Runs the text through every supported kernel, split at random and
+ * written in place whenever the engine allows it as the module does, and
+ * aborts unless the output and final state match the reference.
+ */
+static void bench_verify_engine (unsigned char *data, size_t len, int mode,
+                                 const no_newlines_conf_t *conf)
+{
+        int                   preserving, ok;
+        size_t                rlen, olen, pos, n, pending;
+        unsigned char        *ref, *out, *chunk, *end;
+        no_newlines_t         nl;
+        no_newlines_kernel_e  k;
+
+        ref = malloc (len + NO_NEWLINES_PENDING_MAX + 1);
+        out = malloc (len + NO_NEWLINES_PENDING_MAX + 1);
+        chunk = malloc (len + NO_NEWLINES_PENDING_MAX + 1);
+
+        if (ref == NULL || out == NULL || chunk == NULL) {
+                perror ("no_newlines_bench");
+                exit (1);
+        }
+
+        preserving = 0;
+
+        if (conf) {
+                rlen = bench_reference_whole (data, len, ref, mode, conf, &preserving);
+
+        } else if (mode == no_newlines_mode_html || mode == no_newlines_mode_xml) {
+                rlen = bench_reference (data, len, ref, &preserving);
+
+        } else if (mode == no_newlines_mode_json) {
+                rlen = bench_reference_json (data, len, ref);
+
+        } else {
+                rlen = bench_reference_whole (data, len, ref, mode, NULL, &preserving);
+        }
+
+        for (k = no_newlines_kernel_scalar; no_newlines_kernel_name (k); k++) {
+                if (!no_newlines_kernel_supported (k)) {
+                        continue;
+                }
+
+                no_newlines_use_kernel (k);
+                no_newlines_init (&nl, mode, conf);
+
+                olen = 0;
+                ok = 1;
+
+                for (pos = 0; pos < len; pos += n) {
+                        /* mostly short chunks, to split markers and runs often */
+                        n = 1 + bench_random () % ((bench_random () & 1) ? 16 : len - pos);
+                        n = (n < len - pos) ? n : len - pos;
+
+                        pending = no_newlines_pending (&nl);
+                        memcpy (chunk, data + pos, n);
+
+                        if (pending == 0) {
+                                end = no_newlines_feed (&nl, chunk, n, chunk);
+                                memcpy (out + olen, chunk, end - chunk);
+                                olen += end - chunk;
+
+                        } else {
+                                end = no_newlines_feed (&nl, chunk, n, out + olen);
+                                ok &= (size_t) (end - (out + olen)) <= n + pending;
+                                olen = end - out;
+                        }
+                }
+
+                ok &= no_newlines_preserving (&nl) == preserving;
+                olen = no_newlines_finish (&nl, out + olen) - out;
+
+                if (!ok || olen != rlen || memcmp (out, ref, rlen) != 0) {
+                        fprintf (stderr, "no_newlines_bench: \"%s\" kernel mismatch "
+                                 "for %s%s on:\n", no_newlines_kernel_name (k), bench_modes[mode],
+                                 conf ? " with options" : "");
+                        fwrite (data, 1, len, stderr);
+                        fprintf (stderr, "\nexpected:\n");
+                        fwrite (ref, 1, rlen, stderr);
+                        fprintf (stderr, "\ngot:\n");
+                        fwrite (out, 1, olen, stderr);
+                        fprintf (stderr, "\n");
+                        abort ();
+                }
+        }
+
+        free (ref);
+        free (out);
+        free (chunk);
+}
+
+
+/*
+ * The loop that stripped a buffer before the automaton, run on the whole
+ * text with a NUL after it, as when the body came in a single buffer.
+ */
+static size_t bench_reference (unsigned char *data, size_t len, unsigned char *out,
+                               int *preserving)
+{
+        int             state, space_eaten;
+        unsigned char  *reader, *writer, *last, *text;
+
+        text = malloc (len + 1);
+        if (text == NULL) {
+                perror ("no_newlines_bench");
+                exit (1);
+        }
+
+        memcpy (text, data, len);
+        text[len] = '\0';
+
+        state = 0;
+        space_eaten = 0;
+        last = text + len;
+
+        for (writer = text, reader = text; reader < last; reader++) {
+                if (state == 0) {
+                        if (bench_reference_space (reader)) {
+                                space_eaten = 1;
+                                reader++;
+                                while (reader < last && bench_reference_space (reader)) {
+                                        reader++;
+                                }
+                                if (reader >= last) {
+                                        break;
+                                }
+                        }
+
+                        if (space_eaten && *reader != '<') {
+                                *writer++ = ' ';
+                        }
+                        space_eaten = 0;
+
+                        if (*reader == '>') {
+                                *writer++ = *reader++;
+                                while (reader < last && bench_reference_space (reader)) {
+                                        reader++;
+                                }
+                                if (reader >= last) {
+                                        break;
+                                }
+                        }
+
+                        if ((size_t) (last - reader) >= sizeof(NO_NEWLINES_SC_OFF) - 1
+                            && strncasecmp ((char *) reader, NO_NEWLINES_SC_OFF,
+                                            sizeof(NO_NEWLINES_SC_OFF) - 1) == 0) {
+                                state = 1;
+                                reader += sizeof(NO_NEWLINES_SC_OFF) - 1;
+                        }
+
+                } else {
+                        if ((size_t) (last - reader) >= sizeof(NO_NEWLINES_SC_ON) - 1
+                            && strncasecmp ((char *) reader, NO_NEWLINES_SC_ON,
+                                            sizeof(NO_NEWLINES_SC_ON) - 1) == 0) {
+                                state = 0;
+                                reader += sizeof(NO_NEWLINES_SC_ON) - 1;
+                        }
+                }
+
+                if (reader < last) {
+                        *writer++ = *reader;
+                }
+        }
+
+        len = writer - text;
+
+        memcpy (out, text, len);
+        free (text);
+
+        *preserving = state;
+
+        return len;
+}
+
+
+static int bench_reference_space (unsigned char *p)
+{
+        return *p == '\n' || *p == '\r' || *p == '\t' || (*p == ' ' && *(p + 1) == ' ');
+}
+
+
+/* JSON as it would be stripped by hand: whitespace goes, outside of strings */
+static size_t bench_reference_json (unsigned char *data, size_t len, unsigned char *out)
+{
+        int             string, escape;
+        size_t          i, n;
+
+        string = 0;
+        escape = 0;
+
+        for (i = 0, n = 0; i < len; i++) {
+                if (escape) {
+                        escape = 0;
+
+                } else if (string && data[i] == '\\') {
+                        escape = 1;
+
+                } else if (data[i] == '"') {
+                        string = !string;
+
+                } else if (!string && (data[i] == ' ' || data[i] == '\n'
+                                       || data[i] == '\r' || data[i] == '\t')) {
+                        continue;
+                }
+
+                out[n++] = data[i];
+        }
+
+        return n;
+}
+
+
+/*
+ * The engine fed the whole text at once, with the scalar kernel: what
+ * any splitting, and any kernel, must give.
+ */
+static size_t bench_reference_whole (unsigned char *data, size_t len, unsigned char *out,
+                                     int mode, const no_newlines_conf_t *conf,
+                                     int *preserving)
+{
+        unsigned char  *end;
+        no_newlines_t   nl;
+
+        no_newlines_use_kernel (no_newlines_kernel_scalar);
+        no_newlines_init (&nl, mode, conf);
+
+        end = no_newlines_feed (&nl, data, len, out);
+        *preserving = no_newlines_preserving (&nl);
+
+        return no_newlines_finish (&nl, end) - out;
+}
+
+
+/* Options that keep the comma-separated elements as they are */
+static void bench_elements (no_newlines_conf_t *conf, const char *list)
+{
+        size_t  len;
+
+        no_newlines_conf_init (conf);
+
+        while (*list) {
+                len = strcspn (list, ",");
+
+                if (len
+                    && no_newlines_conf_element (conf, (const unsigned char *) list, len) != 0) {
+                        fprintf (stderr, "no_newlines_bench: cannot preserve \"%.*s\"\n",
+                                 (int) len, list);
+                        exit (2);
+                }
+
+                list += len + (list[len] == ',');
+        }
+}
+
+
+/* Drops comments, but for those that start with the comma-separated prefixes */
+static void bench_comments (no_newlines_conf_t *conf, const char *list)
+{
+        size_t  len;
+
+        no_newlines_conf_comments (conf);
+
+        while (*list) {
+                len = strcspn (list, ",");
+
+                if (len
+                    && no_newlines_conf_comment (conf, (const unsigned char *) list, len) != 0) {
+                        fprintf (stderr, "no_newlines_bench: cannot keep \"%.*s\"\n",
+                                 (int) len, list);
+                        exit (2);
+                }
+
+                list += len + (list[len] == ',');
+        }
+}
+
+
+/* Sets the comma-separated markers, in pairs of an off and an on one */
+static void bench_markers (no_newlines_conf_t *conf, const char *list)
+{
+        size_t  off, on;
+
+        while (*list) {
+                off = strcspn (list, ",");
+                on = (list[off] == ',') ? strcspn (list + off + 1, ",") : 0;
+
+                if (no_newlines_conf_markers (conf, (const unsigned char *) list, off,
+                                              (const unsigned char *) list + off + 1, on) != 0) {
+                        fprintf (stderr, "no_newlines_bench: cannot set markers \"%.*s\"\n",
+                                 (int) (off + 1 + on), list);
+                        exit (2);
+                }
+
+                list += off + 1 + on;
+                list += (*list == ',');
+        }
+}
@@ -0,0 +1,296 @@
+#!/bin/sh
+#
+# Builds nginx with the module, serves an HTML corpus through it over a
+# static, a proxied, a chunked (proxied from an SSI backend, which sends
+# no length), a gzip location and a gzip one with no_newlines_store, with
+# no_newlines on and off, checks that pages sent by sendfile, chunked or
+# from the store are those stripped afresh, and loads every page of every
+# location with wrk.  Prints a JSON array of the requests per second, the
+# 50th and 99th percentile latencies, the CPU time of the front nginx's
+# workers per second of load, and the bytes of one response on the wire.
+#
+#   tools/no_newlines_load.sh -n nginx-source [-c corpus] [-w workdir]
+#                             [-d seconds] [-t threads] [-C connections]
+#                             [-p workers] [-B]
+#
+# nginx is built once into the work directory, and again with -B.  Without
+# a corpus, pages of 4, 32 and 256 kilobytes of indented markup are made.
+
+set -e
+
+repo=$(cd "$(dirname "$0")/.." && pwd)
+src=
+corpus=
+work=${TMPDIR:-/tmp}/no_newlines_load
+duration=10
+threads=2
+connections=32
+workers=1
+rebuild=0
+
+front=8180
+back=8181
+
+usage() {
+        echo "usage: $0 -n nginx-source [-c corpus] [-w workdir] [-d seconds]" \
+             "[-t threads] [-C connections] [-p workers] [-B]" >&2
+        exit 2
+}
+
+while getopts n:c:w:d:t:C:p:B opt; do
+        case $opt in
+        n) src=$OPTARG ;;
+        c) corpus=$OPTARG ;;
+        w) work=$OPTARG ;;
+        d) duration=$OPTARG ;;
+        t) threads=$OPTARG ;;
+        C) connections=$OPTARG ;;
+        p) workers=$OPTARG ;;
+        B) rebuild=1 ;;
+        *) usage ;;
+        esac
+done
+
+[ -n "$src" ] || usage
+
+for tool in wrk curl make; do
+        if ! command -v $tool >/dev/null 2>&1; then
+                echo "$0: $tool is needed" >&2
+                exit 1
+        fi
+done
+
+mkdir -p "$work"
+work=$(cd "$work" && pwd)
+nginx=$work/nginx/sbin/nginx
+
+
+# nginx, with the module and the stock proxy, SSI and gzip modules
+
+if [ ! -x "$nginx" ] || [ $rebuild = 1 ]; then
+        (cd "$src" \
+         && ./configure --prefix="$work/nginx" --add-module="$repo" \
+                        --without-http_rewrite_module >"$work/configure.log" 2>&1 \
+         && make -j"$(getconf _NPROCESSORS_ONLN)" >"$work/make.log" 2>&1 \
+         && make install >>"$work/make.log" 2>&1) || {
+                echo "$0: building nginx failed, see $work/configure.log and $work/make.log" >&2
+                exit 1
+        }
+fi
+
+
+# the corpus
+
+if [ -z "$corpus" ]; then
+        corpus=$work/corpus
+        mkdir -p "$corpus"
+
+        for kb in 4 32 256; do
+                awk -v size=$((kb * 1024)) 'BEGIN {
+                        print "<!DOCTYPE html>\n<html>\n  <head>\n" \
+                              "    <title>page</title>\n  </head>\n  <body>"
+                        n = 60
+                        for (i = 0; n < size; i++) {
+                                line = sprintf("    <div class=\"item\">\n      <p>\n" \
+                                               "        Item %d,\tsome  text\n" \
+                                               "      </p>\n    </div>\n", i)
+                                if (i % 50 == 0) {
+                                        line = line "    <!--SC_OFF--><pre>\n" \
+                                                    "  kept  as  it  is\n</pre><!--SC_ON-->\n"
+                                }
+                                printf "%s", line
+                                n += length(line)
+                        }
+                        print "  </body>\n</html>"
+                }' >"$corpus/page-${kb}k.html"
+        done
+fi
+
+corpus=$(cd "$corpus" && pwd)
+pages=$(cd "$corpus" && ls | grep -E '\.html?$' | grep -v '\.min\.')
+
+if [ -z "$pages" ]; then
+        echo "$0: no HTML pages in $corpus" >&2
+        exit 1
+fi
+
+
+# the backend sends the corpus as it is, with a length or, through SSI, chunked
+
+mkdir -p "$work/back/logs" "$work/back/conf" "$work/front/logs" "$work/front/conf"
+rm -rf "$work/store"
+mkdir -p "$work/store"
+
+cat >"$work/back/conf/nginx.conf" <<EOF
+worker_processes 1;
+error_log logs/error.log;
+pid logs/nginx.pid;
+events { worker_connections 4096; }
+http {
+    include $work/nginx/conf/mime.types;
+    access_log off;
+    server {
+        listen 127.0.0.1:$back;
+        location /plain/ { alias $corpus/; }
+        location /ssi/ { alias $corpus/; ssi on; }
+    }
+}
+EOF
+
+locations=
+for mode in on off; do
+        locations="$locations
+        location /$mode/static/ { no_newlines $mode; alias $corpus/; }
+        location /$mode/proxy/ { no_newlines $mode; proxy_pass http://back/plain/; }
+        location /$mode/chunked/ { no_newlines $mode; proxy_pass http://back/ssi/; }
+        location /$mode/gzip/ {
+            no_newlines $mode; alias $corpus/;
+            gzip on; gzip_min_length 0; gzip_comp_level 1;
+        }
+        location /$mode/store/ {
+            no_newlines $mode; no_newlines_store $work/store; alias $corpus/;
+            gzip on; gzip_min_length 0; gzip_comp_level 1;
+        }"
+done
+
+cat >"$work/front/conf/nginx.conf" <<EOF
+worker_processes $workers;
+error_log logs/error.log notice;
+pid logs/nginx.pid;
+events { worker_connections 4096; }
+http {
+    include $work/nginx/conf/mime.types;
+    access_log off;
+    sendfile on;
+    upstream back { server 127.0.0.1:$back; keepalive 64; }
+    proxy_http_version 1.1;
+    proxy_set_header Connection "";
+    proxy_set_header Accept-Encoding "";
+    server {
+        listen 127.0.0.1:$front;$locations
+    }
+}
+EOF
+
+
+stop() {
+        for dir in "$work/front" "$work/back"; do
+                if [ -f "$dir/logs/nginx.pid" ]; then
+                        "$nginx" -p "$dir" -s stop 2>/dev/null || true
+                fi
+        done
+}
+
+trap stop EXIT INT TERM
+
+stop
+"$nginx" -p "$work/back" -t -q
+"$nginx" -p "$work/front" -t -q
+"$nginx" -p "$work/back"
+"$nginx" -p "$work/front"
+sleep 1
+
+
+# CPU ticks used so far by the front nginx's workers
+
+cpu() {
+        total=0
+        for pid in $(pgrep -P "$(cat "$work/front/logs/nginx.pid")"); do
+                ticks=$(awk '{ print $14 + $15 }' "/proc/$pid/stat")
+                total=$((total + ticks))
+        done
+        echo $total
+}
+
+# a wrk latency, as "50%  1.23ms", in milliseconds
+
+ms() {
+        awk -v p="$1" '$1 == p {
+                v = $2
+                if (v ~ /us$/) { sub(/us$/, "", v); v /= 1000 }
+                else if (v ~ /ms$/) { sub(/ms$/, "", v) }
+                else if (v ~ /s$/) { sub(/s$/, "", v); v *= 1000 }
+                printf "%.3f", v
+        }'
+}
+
+# a page read from a file, which sendfile would send from the file, and
+# one sent chunked must be the page stripped afresh from the proxy's memory
+
+for page in $pages; do
+        fresh=$(curl -sf "http://127.0.0.1:$front/on/proxy/$page" | cksum)
+
+        for path in static chunked; do
+                sent=$(curl -sf "http://127.0.0.1:$front/on/$path/$page" | cksum)
+
+                if [ "$sent" != "$fresh" ]; then
+                        echo "$0: $page from /on/$path/ differs from $page stripped" >&2
+                        exit 1
+                fi
+        done
+done
+
+# a page sent from the store, through gzip, must be the page stripped
+# afresh: the first request stores it, and the second is sent the copy
+
+for page in $pages; do
+        fresh=$(curl -sf -H "Accept-Encoding: gzip" \
+                     "http://127.0.0.1:$front/on/gzip/$page" | gzip -dc | cksum)
+
+        for try in 1 2; do
+                stored=$(curl -sf -H "Accept-Encoding: gzip" \
+                              "http://127.0.0.1:$front/on/store/$page" | gzip -dc | cksum)
+
+                if [ "$stored" != "$fresh" ]; then
+                        echo "$0: $page from the store differs from $page stripped" >&2
+                        exit 1
+                fi
+        done
+done
+
+
+hz=$(getconf CLK_TCK)
+first=1
+
+echo "["
+
+for page in $pages; do
+        for path in static proxy chunked gzip store; do
+                for mode in on off; do
+                        url=http://127.0.0.1:$front/$mode/$path/$page
+                        enc=identity
+                        [ $path = gzip ] || [ $path = store ] && enc=gzip
+
+                        sizes=$(curl -sf -o /dev/null -H "Accept-Encoding: $enc" \
+                                     -w '%{size_header} %{size_download}' "$url") || {
+                                echo "$0: $url failed" >&2
+                                exit 1
+                        }
+                        bytes=$(echo "$sizes" | awk '{ print $1 + $2 }')
+
+                        before=$(cpu)
+                        out=$(wrk -t"$threads" -c"$connections" -d"$duration"s --latency \
+                                  -H "Accept-Encoding: $enc" "$url")
+                        after=$(cpu)
+
+                        rps=$(echo "$out" | awk '/^Requests\/sec:/ { print $2 }')
+                        p50=$(echo "$out" | ms 50%)
+                        p99=$(echo "$out" | ms 99%)
+                        load=$(awk -v t=$((after - before)) -v hz="$hz" -v d="$duration" \
+                                   'BEGIN { printf "%.1f", 100 * t / hz / d }')
+
+                        [ $first = 1 ] || echo ","
+                        first=0
+
+                        printf '  {"page": "%s", "path": "%s", "no_newlines": "%s",' \
+                               "$page" "$path" "$mode"
+                        printf ' "req_per_s": %s, "p50_ms": %s, "p99_ms": %s,' \
+                               "$rps" "$p50" "$p99"
+                        printf ' "worker_cpu_percent": %s, "bytes_per_response": %s}' \
+                               "$load" "$bytes"
+                done
+        done
+done
+
+echo
+echo "]"
@@ -0,0 +1,578 @@
+/*
+ * Strips every file of a known kind under the given directories into a
+ * .min sibling (foo.html into foo.min.html), for no_newlines_static to
+ * send: .html and .htm as HTML, .xml and .svg as XML, .json as JSON, .css
+ * as CSS, and .js and .mjs as JavaScript, or only the extensions given
+ * with -e.  A sibling that is at least as new as its file is left alone,
+ * so running it again after a deploy only strips what has changed.
+ *
+ * The options of HTML and XML are those of the module's directives, so
+ * that a sibling is what the location would have sent: -p for
+ * no_newlines_preserve, -M for no_newlines_markers, -K for
+ * no_newlines_drop_markers off, -C for no_newlines_strip_comments, with ''
+ * for no prefix, -b for no_newlines_blocks, and -l for no_newlines_level.
+ *
+ *      no_newlines_minify [-f] [-v] [-j threads] [-e ext,...] [-p element,...]
+ *                         [-M off,on,...] [-K] [-C prefix,...] [-b] [-l level]
+ *                         directory...
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "no_newlines.h"
+
+#define MINIFY_BUF  (64 * 1024)
+
+typedef struct {
+        char   **names;
+        size_t   n;
+        size_t   size;
+} minify_list_t;
+
+typedef struct {
+        const char          *ext;
+        no_newlines_mode_e   mode;
+        int                  enabled;
+} minify_type_t;
+
+static int minify_collect (const char *name, const struct stat *st, int type,
+                           struct FTW *ftw);
+static void *minify_worker (void *data);
+static int minify_file (const char *name, unsigned char *in, unsigned char *out);
+static char *minify_sibling (const char *name);
+static int minify_write (int fd, unsigned char *p, size_t len);
+static minify_type_t *minify_type (const char *ext);
+static int minify_extensions (const char *list);
+static int minify_elements (no_newlines_conf_t *conf, const char *list);
+static int minify_comments (no_newlines_conf_t *conf, const char *list);
+static int minify_markers (no_newlines_conf_t *conf, const char *list);
+
+static minify_list_t    minify_files;
+static size_t           minify_next;   /* the next file to strip */
+static int              minify_failed;
+static int              minify_force;
+static int              minify_verbose;
+static pthread_mutex_t  minify_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static no_newlines_conf_t   minify_conf;
+static no_newlines_conf_t  *minify_engine;  /* the options, if any are given */
+
+/* The extensions stripped, and their engines */
+static minify_type_t  minify_types[] = {
+        { "html", no_newlines_mode_html, 1 },
+        { "htm",  no_newlines_mode_html, 1 },
+        { "xml",  no_newlines_mode_xml,  1 },
+        { "svg",  no_newlines_mode_xml,  1 },
+        { "json", no_newlines_mode_json, 1 },
+        { "css",  no_newlines_mode_css,  1 },
+        { "js",   no_newlines_mode_js,   1 },
+        { "mjs",  no_newlines_mode_js,   1 },
+        { NULL,   no_newlines_mode_html, 0 }
+};
+
+
+int main (int argc, char **argv)
+{
+        int          c, i, level, kept_markers, blocks;
+        long         threads;
+        pthread_t   *tids;
+        const char  *elements, *pairs, *kept;
+
+        threads = sysconf (_SC_NPROCESSORS_ONLN);
+        elements = NULL;
+        pairs = NULL;
+        kept = NULL;
+        kept_markers = 0;
+        blocks = 0;
+        level = 1;
+
+        while ((c = getopt (argc, argv, "fvj:e:p:M:KC:bl:")) != -1) {
+                switch (c) {
+
+                case 'f':
+                        minify_force = 1;
+                        break;
+
+                case 'v':
+                        minify_verbose = 1;
+                        break;
+
+                case 'j':
+                        threads = atol (optarg);
+                        break;
+
+                case 'e':
+                        if (minify_extensions (optarg) != 0) {
+                                return 2;
+                        }
+                        break;
+
+                case 'p':
+                        elements = optarg;
+                        minify_engine = &minify_conf;
+                        break;
+
+                case 'M':
+                        pairs = optarg;
+                        minify_engine = &minify_conf;
+                        break;
+
+                case 'K':
+                        kept_markers = 1;
+                        minify_engine = &minify_conf;
+                        break;
+
+                case 'C':
+                        kept = optarg;
+                        minify_engine = &minify_conf;
+                        break;
+
+                case 'b':
+                        blocks = 1;
+                        minify_engine = &minify_conf;
+                        break;
+
+                case 'l':
+                        level = atoi (optarg);
+                        minify_engine = &minify_conf;
+                        break;
+
+                default:
+                        goto usage;
+                }
+        }
+
+        if (optind == argc || threads < 1) {
+                goto usage;
+        }
+
+        no_newlines_init_tables ();
+        no_newlines_use_kernel (no_newlines_kernel_auto);
+
+        /* built once, as the module does, and shared by all the threads */
+        no_newlines_conf_init (&minify_conf);
+
+        if ((elements && minify_elements (&minify_conf, elements) != 0)
+            || (pairs && minify_markers (&minify_conf, pairs) != 0)
+            || (kept && minify_comments (&minify_conf, kept) != 0)) {
+                return 2;
+        }
+
+        if (kept_markers) {
+                no_newlines_conf_keep_markers (&minify_conf);
+        }
+
+        if (blocks) {
+                no_newlines_conf_blocks (&minify_conf);
+        }
+
+        if (no_newlines_conf_level (&minify_conf, (unsigned int) level) != 0) {
+                fprintf (stderr, "no_newlines_minify: invalid level %d\n", level);
+                return 2;
+        }
+
+        for (i = optind; i < argc; i++) {
+                if (nftw (argv[i], minify_collect, 64, FTW_PHYS) != 0) {
+                        fprintf (stderr, "no_newlines_minify: %s: %s\n",
+                                 argv[i], strerror (errno));
+                        return 1;
+                }
+        }
+
+        if ((size_t) threads > minify_files.n) {
+                threads = minify_files.n ? (long) minify_files.n : 1;
+        }
+
+        tids = malloc (threads * sizeof(pthread_t));
+        if (tids == NULL) {
+                perror ("no_newlines_minify");
+                return 1;
+        }
+
+        for (i = 0; i < threads; i++) {
+                if (pthread_create (&tids[i], NULL, minify_worker, NULL) != 0) {
+                        perror ("no_newlines_minify: pthread_create");
+                        return 1;
+                }
+        }
+
+        for (i = 0; i < threads; i++) {
+                pthread_join (tids[i], NULL);
+        }
+
+        return minify_failed ? 1 : 0;
+
+usage:
+
+        fprintf (stderr, "usage: no_newlines_minify [-f] [-v] [-j threads] [-e ext,...] "
+                         "[-p element,...]\n"
+                         "                          [-M off,on,...] [-K] [-C prefix,...] "
+                         "[-b] [-l level] directory...\n");
+        return 2;
+}
+
+
+/* Lists the files to strip, skipping the siblings themselves */
+static int minify_collect (const char *name, const struct stat *st, int type,
+                           struct FTW *ftw)
+{
+        char       **names;
+        const char  *dot;
+
+        if (type != FTW_F || !S_ISREG (st->st_mode)) {
+                return 0;
+        }
+
+        dot = strrchr (name + ftw->base, '.');
+
+        if (dot == NULL || !minify_type (dot + 1)->enabled) {
+                return 0;
+        }
+
+        if (dot - (name + ftw->base) >= 4 && strncmp (dot - 4, ".min", 4) == 0) {
+                return 0;
+        }
+
+        if (minify_files.n == minify_files.size) {
+                minify_files.size = minify_files.size ? 2 * minify_files.size : 256;
+
+                names = realloc (minify_files.names,
+                                 minify_files.size * sizeof(char *));
+                if (names == NULL) {
+                        return -1;
+                }
+
+                minify_files.names = names;
+        }
+
+        minify_files.names[minify_files.n] = strdup (name);
+        if (minify_files.names[minify_files.n] == NULL) {
+                return -1;
+        }
+
+        minify_files.n++;
+
+        return 0;
+}
+
+
+static void *minify_worker (void *data)
+{
+        size_t          i;
+        unsigned char  *in, *out;
+
+        (void) data;
+
+        in = malloc (MINIFY_BUF);
+        out = malloc (MINIFY_BUF + NO_NEWLINES_PENDING_MAX);
+
+        if (in == NULL || out == NULL) {
+                perror ("no_newlines_minify");
+                pthread_mutex_lock (&minify_mutex);
+                minify_failed = 1;
+                pthread_mutex_unlock (&minify_mutex);
+                return NULL;
+        }
+
+        for ( ;; ) {
+                pthread_mutex_lock (&minify_mutex);
+                i = minify_next++;
+                pthread_mutex_unlock (&minify_mutex);
+
+                if (i >= minify_files.n) {
+                        break;
+                }
+
+                if (minify_file (minify_files.names[i], in, out) != 0) {
+                        pthread_mutex_lock (&minify_mutex);
+                        minify_failed = 1;
+                        pthread_mutex_unlock (&minify_mutex);
+                }
+        }
+
+        free (in);
+        free (out);
+
+        return NULL;
+}
+
+
+/*
+ * Strips a file into a temporary file next to it, which is then renamed
+ * over the sibling, so that a sibling is never seen half written.
+ */
+static int minify_file (const char *name, unsigned char *in, unsigned char *out)
+{
+        int            fd, tfd;
+        char          *sibling, *temp;
+        ssize_t        n;
+        size_t         len;
+        struct stat    st, sst;
+        no_newlines_t  nl;
+
+        sibling = minify_sibling (name);
+        if (sibling == NULL) {
+                fprintf (stderr, "no_newlines_minify: %s: %s\n", name, strerror (errno));
+                return -1;
+        }
+
+        temp = NULL;
+        fd = -1;
+        tfd = -1;
+
+        if (stat (name, &st) != 0) {
+                goto failed;
+        }
+
+        if (!minify_force && stat (sibling, &sst) == 0 && sst.st_mtime >= st.st_mtime) {
+                free (sibling);
+                return 0;
+        }
+
+        len = strlen (sibling);
+
+        temp = malloc (len + sizeof(".XXXXXX"));
+        if (temp == NULL) {
+                goto failed;
+        }
+
+        memcpy (temp, sibling, len);
+        memcpy (temp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+        fd = open (name, O_RDONLY);
+        if (fd == -1) {
+                goto failed;
+        }
+
+        tfd = mkstemp (temp);
+        if (tfd == -1) {
+                goto failed;
+        }
+
+        no_newlines_init (&nl, minify_type (strrchr (name, '.') + 1)->mode, minify_engine);
+
+        while ((n = read (fd, in, MINIFY_BUF)) > 0) {
+                if (minify_write (tfd, out, no_newlines_feed (&nl, in, n, out) - out) != 0) {
+                        goto failed;
+                }
+        }
+
+        if (n == -1
+            || minify_write (tfd, out, no_newlines_finish (&nl, out) - out) != 0
+            || fchmod (tfd, st.st_mode & 0777) != 0) {
+                goto failed;
+        }
+
+        n = close (tfd);
+        tfd = -1;
+
+        if (n != 0) {
+                goto failed;
+        }
+
+        if (rename (temp, sibling) != 0) {
+                goto failed;
+        }
+
+        if (minify_verbose) {
+                printf ("%s\n", sibling);
+        }
+
+        close (fd);
+        free (temp);
+        free (sibling);
+
+        return 0;
+
+failed:
+
+        fprintf (stderr, "no_newlines_minify: %s: %s\n", name, strerror (errno));
+
+        if (fd != -1) {
+                close (fd);
+        }
+
+        if (temp) {
+                if (tfd != -1) {
+                        close (tfd);
+                }
+
+                unlink (temp);
+                free (temp);
+        }
+
+        free (sibling);
+
+        return -1;
+}
+
+
+/* foo.html becomes foo.min.html */
+static char *minify_sibling (const char *name)
+{
+        char   *sibling;
+        size_t  len, stem;
+
+        len = strlen (name);
+        stem = strrchr (name, '.') - name;
+
+        sibling = malloc (len + sizeof(".min"));
+        if (sibling == NULL) {
+                return NULL;
+        }
+
+        memcpy (sibling, name, stem);
+        memcpy (sibling + stem, ".min", sizeof(".min") - 1);
+        memcpy (sibling + stem + sizeof(".min") - 1, name + stem, len - stem + 1);
+
+        return sibling;
+}
+
+
+static int minify_write (int fd, unsigned char *p, size_t len)
+{
+        ssize_t n;
+
+        while (len) {
+                n = write (fd, p, len);
+                if (n == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return -1;
+                }
+
+                p += n;
+                len -= n;
+        }
+
+        return 0;
+}
+
+
+/* The kind of an extension, or the end of the list if it is not known */
+static minify_type_t *minify_type (const char *ext)
+{
+        minify_type_t  *t;
+
+        for (t = minify_types; t->ext; t++) {
+                if (strcmp (t->ext, ext) == 0) {
+                        break;
+                }
+        }
+
+        return t;
+}
+
+
+/* Strips only the files with the comma-separated extensions */
+static int minify_extensions (const char *list)
+{
+        size_t          len;
+        minify_type_t  *t;
+
+        for (t = minify_types; t->ext; t++) {
+                t->enabled = 0;
+        }
+
+        while (*list) {
+                len = strcspn (list, ",");
+
+                for (t = minify_types; t->ext; t++) {
+                        if (strlen (t->ext) == len && strncmp (t->ext, list, len) == 0) {
+                                t->enabled = 1;
+                                break;
+                        }
+                }
+
+                if (len && t->ext == NULL) {
+                        fprintf (stderr, "no_newlines_minify: unknown extension \"%.*s\"\n",
+                                 (int) len, list);
+                        return -1;
+                }
+
+                list += len + (list[len] == ',');
+        }
+
+        return 0;
+}
+
+
+/* Keeps the comma-separated elements as they are */
+static int minify_elements (no_newlines_conf_t *conf, const char *list)
+{
+        size_t  len;
+
+        while (*list) {
+                len = strcspn (list, ",");
+
+                if (len
+                    && no_newlines_conf_element (conf, (const unsigned char *) list, len) != 0) {
+                        fprintf (stderr, "no_newlines_minify: cannot preserve \"%.*s\"\n",
+                                 (int) len, list);
+                        return -1;
+                }
+
+                list += len + (list[len] == ',');
+        }
+
+        return 0;
+}
+
+
+/* Drops comments, but for those that start with the comma-separated prefixes */
+static int minify_comments (no_newlines_conf_t *conf, const char *list)
+{
+        size_t  len;
+
+        no_newlines_conf_comments (conf);
+
+        while (*list) {
+                len = strcspn (list, ",");
+
+                if (len
+                    && no_newlines_conf_comment (conf, (const unsigned char *) list, len) != 0) {
+                        fprintf (stderr, "no_newlines_minify: cannot keep \"%.*s\"\n",
+                                 (int) len, list);
+                        return -1;
+                }
+
+                list += len + (list[len] == ',');
+        }
+
+        return 0;
+}
+
+
+/* Sets the comma-separated markers, in pairs of an off and an on one */
+static int minify_markers (no_newlines_conf_t *conf, const char *list)
+{
+        size_t  off, on;
+
+        while (*list) {
+                off = strcspn (list, ",");
+                on = (list[off] == ',') ? strcspn (list + off + 1, ",") : 0;
+
+                if (no_newlines_conf_markers (conf, (const unsigned char *) list, off,
+                                              (const unsigned char *) list + off + 1, on) != 0) {
+                        fprintf (stderr, "no_newlines_minify: cannot set markers \"%.*s\"\n",
+                                 (int) (off + 1 + on), list);
+                        return -1;
+                }
+
+                list += off + 1 + on;
+                list += (*list == ',');
+        }
+
+        return 0;
+}